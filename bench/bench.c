@@ -0,0 +1,451 @@
+// Throughput benchmarks for json.h: parse, serialize, free and lookups over
+// corpora shaped like twitter.json, canada.json and citm_catalog.json, an
+// NDJSON log and one deeply nested value. The corpora are generated, so the
+// suite runs without any data; pass files to measure real ones instead,
+// those ending in .ndjson or .jsonl being read as JSON Lines:
+//
+//   make bench
+//   make bench CORPORA="twitter.json canada.json logs.ndjson"
+//
+// Each operation repeats for at least BENCH_SECONDS and reports its fastest
+// run as MB/s of input, with the allocations it made counted through
+// json_set_allocator. Built with JSON_STATS (make bench-stats) the library
+// counters are printed as well, including the share of parse time spent
+// scanning rather than allocating.
+#define JSON_IMPLEMENTATION
+#include "../json.h"
+
+#include <stdarg.h>
+#include <time.h>
+
+#define BENCH_SECONDS 0.5
+#define BENCH_MIN_RUNS 3
+
+typedef struct {
+    json_buf buf;
+    const char *data;
+    size_t len;
+    int lines;
+    char name[64];
+} bench_corpus;
+
+typedef struct {
+    double seconds;
+    size_t runs;
+    uint64_t allocations;
+    uint64_t bytes;
+} bench_result;
+
+static uint64_t bench_allocations;
+static uint64_t bench_bytes;
+
+static void *bench_malloc(void *user, size_t size) {
+    (void)user;
+    __atomic_fetch_add(&bench_allocations, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&bench_bytes, size, __ATOMIC_RELAXED);
+    return malloc(size);
+}
+
+static void *bench_realloc(void *user, void *ptr, size_t size) {
+    (void)user;
+    __atomic_fetch_add(&bench_allocations, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&bench_bytes, size, __ATOMIC_RELAXED);
+    return realloc(ptr, size);
+}
+
+static void bench_free(void *user, void *ptr) {
+    (void)user;
+    free(ptr);
+}
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static uint64_t bench_seed = 88172645463325252ull;
+
+static uint64_t bench_random(void) {
+    bench_seed ^= bench_seed << 13;
+    bench_seed ^= bench_seed >> 7;
+    bench_seed ^= bench_seed << 17;
+    return bench_seed;
+}
+
+static void bench_printf(json_buf *b, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    if (n < 0 || !json__buf_reserve(b, (size_t)n)) {
+        fprintf(stderr, "error, failed to generate corpus\n");
+        exit(1);
+    }
+    va_start(ap, fmt);
+    vsnprintf(b->data + b->len, (size_t)n + 1, fmt, ap);
+    va_end(ap);
+    b->len += (size_t)n;
+}
+
+static void bench_words(json_buf *b, size_t n) {
+    static const char *words[] = {
+        "the", "json", "parser", "\\u3053\\u3093\\u306b\\u3061\\u306f", "caf\\u00e9", "\\\"quoted\\\"",
+        "line\\nbreak", "http:\\/\\/example.com\\/x", "benchmark", "\\ud83d\\ude00", "throughput", "arena"
+    };
+    for (size_t i = 0; i < n; i++)
+        bench_printf(b, "%s%s", i ? " " : "", words[bench_random() % (sizeof words / sizeof *words)]);
+}
+
+static bench_corpus bench_corpus_of(json_buf *b, const char *name, int lines) {
+    bench_corpus c = {*b, b->data, b->len, lines, {0}};
+    snprintf(c.name, sizeof c.name, "%s", name);
+    return c;
+}
+
+static bench_corpus bench_twitter(void) {
+    json_buf b = {0};
+    bench_printf(&b, "{\"statuses\":[");
+    for (int i = 0; i < 1200; i++) {
+        bench_printf(&b, "%s{\"id\":%llu,\"id_str\":\"%llu\",\"text\":\"", i ? "," : "",
+                     (unsigned long long)(bench_random() >> 4), (unsigned long long)(bench_random() >> 4));
+        bench_words(&b, 6 + bench_random() % 14);
+        bench_printf(&b, "\",\"truncated\":false,\"in_reply_to_status_id\":null,\"user\":{\"id\":%d,"
+                         "\"screen_name\":\"user_%d\",\"name\":\"",
+                     (int)(bench_random() % 100000000), i);
+        bench_words(&b, 2);
+        bench_printf(&b, "\",\"followers_count\":%d,\"friends_count\":%d,\"verified\":%s,\"lang\":\"%s\","
+                         "\"profile_background_color\":\"C0DEED\"},\"entities\":{\"hashtags\":[",
+                     (int)(bench_random() % 100000), (int)(bench_random() % 5000),
+                     bench_random() % 8 ? "false" : "true", bench_random() % 2 ? "ja" : "en");
+        for (int h = 0, n = (int)(bench_random() % 4); h < n; h++)
+            bench_printf(&b, "%s{\"text\":\"tag%d\",\"indices\":[%d,%d]}", h ? "," : "", h, h * 10, h * 10 + 6);
+        bench_printf(&b, "],\"urls\":[],\"user_mentions\":[]},\"retweet_count\":%d,\"favorited\":false,"
+                         "\"geo\":null,\"coordinates\":null,\"place\":null}",
+                     (int)(bench_random() % 1000));
+    }
+    bench_printf(&b, "],\"search_metadata\":{\"completed_in\":0.087,\"max_id\":505874924095815681,\"count\":100}}");
+    return bench_corpus_of(&b, "twitter", 0);
+}
+
+static bench_corpus bench_canada(void) {
+    json_buf b = {0};
+    bench_printf(&b, "{\"type\":\"FeatureCollection\",\"features\":[");
+    for (int f = 0; f < 40; f++) {
+        bench_printf(&b, "%s{\"type\":\"Feature\",\"properties\":{\"name\":\"Canada\"},"
+                         "\"geometry\":{\"type\":\"Polygon\",\"coordinates\":[",
+                     f ? "," : "");
+        for (int r = 0; r < 4; r++) {
+            bench_printf(&b, "%s[", r ? "," : "");
+            for (int p = 0; p < 700; p++) {
+                double x = -141.0 + (double)(bench_random() % 8000000000ull) / 1e8;
+                double y = 41.0 + (double)(bench_random() % 4200000000ull) / 1e8;
+                bench_printf(&b, "%s[%.15g,%.15g]", p ? "," : "", x, y);
+            }
+            bench_printf(&b, "]");
+        }
+        bench_printf(&b, "]}}");
+    }
+    bench_printf(&b, "]}");
+    return bench_corpus_of(&b, "canada", 0);
+}
+
+static bench_corpus bench_citm(void) {
+    json_buf b = {0};
+    bench_printf(&b, "{\"areaNames\":{");
+    for (int i = 0; i < 20; i++)
+        bench_printf(&b, "%s\"%d\":\"area %d\"", i ? "," : "", 205705993 + i, i);
+    bench_printf(&b, "},\"events\":{");
+    for (int i = 0; i < 2500; i++) {
+        int id = 138586341 + i * 7;
+        bench_printf(&b, "%s\"%d\":{\"description\":null,\"id\":%d,\"logo\":\"/images/UE0AAAAACEKo%dQAAAAVDSVRN\","
+                         "\"name\":\"Event %d\",\"subTopicIds\":[337184269,337184283,%d],\"subjectCode\":null,"
+                         "\"subtitle\":null,\"topicIds\":[324846099,%d]}",
+                     i ? "," : "", id, id, i, i, 337184000 + i % 50, 107888604 + i % 9);
+    }
+    bench_printf(&b, "},\"performances\":[");
+    for (int i = 0; i < 2500; i++) {
+        bench_printf(&b, "%s{\"eventId\":%d,\"id\":%d,\"logo\":null,\"name\":null,\"prices\":[", i ? "," : "",
+                     138586341 + i * 7, 339887544 + i);
+        for (int p = 0; p < 4; p++)
+            bench_printf(&b, "%s{\"amount\":%d,\"audienceSubCategoryId\":337100890,\"seatCategoryId\":%d}",
+                         p ? "," : "", 9500 + p * 3000, 338937295 + p);
+        bench_printf(&b, "],\"seatCategories\":[{\"areas\":[{\"areaId\":205705999,\"blockIds\":[]}],"
+                         "\"seatCategoryId\":338937295}],\"seatMapImage\":null,\"start\":%lld,\"venueCode\":\"PLEYEL_PLEYEL\"}",
+                     1372701600000ll + i * 86400000ll);
+    }
+    bench_printf(&b, "],\"venueNames\":{\"PLEYEL_PLEYEL\":\"Salle Pleyel\"}}");
+    return bench_corpus_of(&b, "citm_catalog", 0);
+}
+
+static bench_corpus bench_ndjson(void) {
+    static const char *levels[] = {"debug", "info", "info", "info", "warn", "error"};
+    json_buf b = {0};
+    for (int i = 0; i < 20000; i++) {
+        bench_printf(&b, "{\"ts\":\"2024-03-%02dT%02d:%02d:%02d.%03dZ\",\"level\":\"%s\",\"msg\":\"",
+                     1 + i % 28, i % 24, i % 60, (i * 7) % 60, i % 1000, levels[bench_random() % 6]);
+        bench_words(&b, 4 + bench_random() % 6);
+        bench_printf(&b, "\",\"req\":{\"id\":\"%016llx\",\"method\":\"GET\",\"path\":\"/api/v1/items/%d\","
+                         "\"status\":%d,\"ms\":%.3f},\"tags\":[\"web\",\"eu-west-1\"]}\n",
+                     (unsigned long long)bench_random(), i, bench_random() % 10 ? 200 : 500,
+                     (double)(bench_random() % 100000) / 1000.0);
+    }
+    return bench_corpus_of(&b, "ndjson_logs", 1);
+}
+
+static bench_corpus bench_deep(void) {
+    json_buf b = {0};
+    size_t depth = JSON_DEFAULT_MAX_DEPTH - 10;
+    for (int r = 0; r < 20; r++) {
+        bench_printf(&b, r ? "," : "[");
+        for (size_t i = 0; i < depth; i++)
+            bench_printf(&b, i % 2 ? "{\"k\":" : "[");
+        bench_printf(&b, "1");
+        for (size_t i = depth; i-- > 0;)
+            bench_printf(&b, i % 2 ? "}" : "]");
+    }
+    bench_printf(&b, "]");
+    return bench_corpus_of(&b, "deep_nesting", 0);
+}
+
+static bench_corpus bench_load(const char *path) {
+    json__file f;
+    if (!json__file_open(&f, path)) {
+        fprintf(stderr, "error, failed to open %s\n", path);
+        exit(1);
+    }
+    json_buf b = {0};
+    if (!json__buf_append(&b, f.data, f.size)) {
+        fprintf(stderr, "error, failed to load %s\n", path);
+        exit(1);
+    }
+    json__file_close(&f);
+    const char *base = strrchr(path, '/');
+    size_t l = strlen(path);
+    int lines = (l > 7 && !strcmp(path + l - 7, ".ndjson")) || (l > 6 && !strcmp(path + l - 6, ".jsonl"));
+    return bench_corpus_of(&b, base ? base + 1 : path, lines);
+}
+
+typedef struct {
+    bench_corpus *corpus;
+    json_value *tree;
+    json_value **trees;
+    size_t count;
+    json_buf out;
+    size_t lookups;
+    size_t threads;
+} bench_state;
+
+static void bench_fail(const bench_corpus *c, const char *what) {
+    fprintf(stderr, "error, %s failed on %s\n", what, c->name);
+    exit(1);
+}
+
+static void bench_parse(bench_state *s) {
+    json_value *v = json_from_buffer(s->corpus->data, s->corpus->len);
+    if (!v)
+        bench_fail(s->corpus, "parse");
+    json_free(&v);
+}
+
+static void bench_document(bench_state *s) {
+    json_document *doc = json_document_from_buffer(s->corpus->data, s->corpus->len);
+    if (!doc)
+        bench_fail(s->corpus, "document parse");
+    json_document_free(&doc);
+}
+
+static void bench_tape(bench_state *s) {
+    json_tape *t = json_tape_from_buffer(s->corpus->data, s->corpus->len);
+    if (!t)
+        bench_fail(s->corpus, "tape parse");
+    json_tape_free(&t);
+}
+
+static void bench_lines(bench_state *s) {
+    json_lines *l = json_lines_from_buffer(s->corpus->data, s->corpus->len, s->threads);
+    if (!l || json_lines_failed(l))
+        bench_fail(s->corpus, "lines parse");
+    json_lines_free(&l);
+}
+
+static void bench_serialize(bench_state *s) {
+    json_buf_reset(&s->out);
+    if (!json_to_buffer(&s->out, s->tree))
+        bench_fail(s->corpus, "serialize");
+}
+
+// Parsing happens before the clock starts, so only the frees are timed.
+static void bench_free_setup(bench_state *s) {
+    for (size_t i = 0; i < s->count; i++)
+        if (!(s->trees[i] = json_from_buffer(s->corpus->data, s->corpus->len)))
+            bench_fail(s->corpus, "parse");
+}
+
+static void bench_free_trees(bench_state *s) {
+    for (size_t i = 0; i < s->count; i++)
+        json_free(&s->trees[i]);
+}
+
+// Looks every member of every object up again by its key.
+static void bench_lookup(bench_state *s) {
+    json_value *small[64];
+    json_value **stack = small;
+    size_t depth = 0, cap = sizeof small / sizeof *small;
+    size_t lookups = 0;
+    stack[depth++] = s->tree;
+    while (depth) {
+        json_value *v = stack[--depth];
+        size_t n = v->type == JSON_OBJECT ? v->object.count : v->type == JSON_ARRAY ? v->array.count : 0;
+        if (depth + n > cap) {
+            while (depth + n > cap)
+                cap *= 2;
+            json_value **temp = stack == small ? malloc(cap * sizeof *temp) : realloc(stack, cap * sizeof *temp);
+            if (!temp)
+                bench_fail(s->corpus, "lookup");
+            if (stack == small)
+                memcpy(temp, small, depth * sizeof *temp);
+            stack = temp;
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (v->type == JSON_ARRAY) {
+                stack[depth++] = v->array.items[i];
+                continue;
+            }
+            kvp *e = &v->object.items[i];
+            if (json_get(v, e->key) != e->val)
+                bench_fail(s->corpus, "lookup");
+            lookups++;
+            stack[depth++] = e->val;
+        }
+    }
+    if (stack != small)
+        free(stack);
+    s->lookups = lookups;
+}
+
+static bench_result bench_run(bench_state *s, void (*setup)(bench_state *), void (*op)(bench_state *)) {
+    bench_result r = {1e30, 0, 0, 0};
+    double total = 0;
+    while (r.runs < BENCH_MIN_RUNS || total < BENCH_SECONDS) {
+        if (setup)
+            setup(s);
+        uint64_t allocations = bench_allocations, bytes = bench_bytes;
+        double t = bench_now();
+        op(s);
+        t = bench_now() - t;
+        r.allocations = bench_allocations - allocations;
+        r.bytes = bench_bytes - bytes;
+        if (t < r.seconds)
+            r.seconds = t;
+        total += t;
+        r.runs++;
+    }
+    return r;
+}
+
+static void bench_report(const bench_corpus *c, const char *op, bench_result r, size_t bytes, const char *extra) {
+    printf("%-16s %-18s %10.1f MB/s %10.3f ms %10llu allocs %10.1f KiB%s\n", c->name, op,
+           (double)bytes / r.seconds / 1e6, r.seconds * 1e3, (unsigned long long)r.allocations,
+           (double)r.bytes / 1024.0, extra ? extra : "");
+}
+
+// Prints and clears the library counters, or only clears them without a
+// name.
+#ifdef JSON_STATS
+static void bench_stats(const char *name) {
+    if (!name) {
+        json_stats_reset();
+        return;
+    }
+    json_stats st;
+    json_stats_get(&st);
+    double scan = st.parse_ns > st.alloc_ns ? (double)(st.parse_ns - st.alloc_ns) / (double)st.parse_ns : 0;
+    printf("  stats %-24s nodes %llu  allocations %llu  bytes %llu  arena chunks %llu  parsed %llu B in %.1f ms"
+           "  scanning %.0f%%  written %llu B in %.1f ms\n",
+           name, (unsigned long long)st.nodes, (unsigned long long)st.allocations,
+           (unsigned long long)st.bytes_allocated, (unsigned long long)st.arena_chunks,
+           (unsigned long long)st.bytes_parsed, (double)st.parse_ns / 1e6, scan * 100,
+           (unsigned long long)st.bytes_written, (double)st.write_ns / 1e6);
+    json_stats_reset();
+}
+#else
+static void bench_stats(const char *name) {
+    (void)name;
+}
+#endif
+
+static void bench_corpus_run(bench_corpus *c) {
+    bench_state s = {c, NULL, NULL, 0, {0}, 0, 1};
+    char extra[64];
+    char name[96];
+
+    if (c->lines) {
+        bench_report(c, "lines 1 thread", bench_run(&s, NULL, bench_lines), c->len, NULL);
+        s.threads = 0;
+        bench_report(c, "lines all cores", bench_run(&s, NULL, bench_lines), c->len, NULL);
+        snprintf(name, sizeof name, "%s lines", c->name);
+        bench_stats(name);
+        return;
+    }
+
+    bench_report(c, "parse", bench_run(&s, NULL, bench_parse), c->len, NULL);
+    snprintf(name, sizeof name, "%s parse", c->name);
+    bench_stats(name);
+    bench_report(c, "document parse", bench_run(&s, NULL, bench_document), c->len, NULL);
+    snprintf(name, sizeof name, "%s document", c->name);
+    bench_stats(name);
+    bench_report(c, "tape parse", bench_run(&s, NULL, bench_tape), c->len, NULL);
+    snprintf(name, sizeof name, "%s tape", c->name);
+    bench_stats(name);
+
+    s.tree = json_from_buffer(c->data, c->len);
+    if (!s.tree)
+        bench_fail(c, "parse");
+    bench_result r = bench_run(&s, NULL, bench_serialize);
+    bench_report(c, "serialize", r, s.out.len, NULL);
+    snprintf(name, sizeof name, "%s serialize", c->name);
+    bench_stats(name);
+
+    r = bench_run(&s, NULL, bench_lookup);
+    snprintf(extra, sizeof extra, " %10.1f M lookups/s", (double)s.lookups / r.seconds / 1e6);
+    bench_report(c, "lookup", r, c->len, extra);
+    json_free(&s.tree);
+
+    s.count = 8;
+    s.trees = malloc(s.count * sizeof *s.trees);
+    if (!s.trees)
+        bench_fail(c, "free");
+    r = bench_run(&s, bench_free_setup, bench_free_trees);
+    bench_report(c, "free", r, c->len * s.count, NULL);
+    free(s.trees);
+    json_buf_free(&s.out);
+}
+
+int main(int argc, char **argv) {
+    json_allocator counting = {bench_malloc, bench_realloc, bench_free, NULL};
+    json_set_allocator(&counting);
+
+    bench_corpus corpora[64];
+    size_t n = 0;
+    if (argc > 1) {
+        for (int i = 1; i < argc && n < sizeof corpora / sizeof *corpora; i++)
+            corpora[n++] = bench_load(argv[i]);
+    } else {
+        corpora[n++] = bench_twitter();
+        corpora[n++] = bench_canada();
+        corpora[n++] = bench_citm();
+        corpora[n++] = bench_ndjson();
+        corpora[n++] = bench_deep();
+    }
+
+    printf("%-16s %-18s %15s %13s %17s %14s\n", "corpus", "operation", "throughput", "best", "allocations",
+           "allocated");
+    for (size_t i = 0; i < n; i++) {
+        printf("%-16s %.2f MB\n", corpora[i].name, (double)corpora[i].len / 1e6);
+        bench_stats(NULL);
+        bench_corpus_run(&corpora[i]);
+        json_buf_free(&corpora[i].buf);
+    }
+    return 0;
+}
@@ -1,6 +1,8 @@
 #ifndef JSON_H
 #define JSON_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
 typedef enum {
@@ -13,25 +15,443 @@ typedef enum {
 } json_type;
 
 typedef struct json_value json_value;
+typedef struct json_arena json_arena;
+typedef struct json_document json_document;
+typedef struct json_tape json_tape;
+typedef struct json_stream json_stream;
+typedef struct json_lines json_lines;
+typedef struct json_lines_reader json_lines_reader;
+typedef struct json_path json_path;
+typedef struct json_intern_table json_intern_table;
+typedef struct json_snapshot json_snapshot;
+typedef struct json_schema json_schema;
+
+typedef enum {
+    JSON_ERROR_NONE,
+    JSON_ERROR_SYNTAX,
+    JSON_ERROR_IO,
+    JSON_ERROR_TOO_LARGE,
+    JSON_ERROR_MEMORY,
+    JSON_ERROR_ABORTED,
+    JSON_ERROR_DEPTH,
+    JSON_ERROR_TYPE
+} json_error;
+
+// Keys and strings are stored decoded: escapes, \uXXXX and surrogate pairs
+// included, with a lone surrogate read as U+FFFD. The printers escape '"',
+// '\\' and control characters again, so any string round-trips.
+//
+// A raw control character fails any string. JSON_PARSE_VALIDATE_UTF8 also
+// fails strings that are not valid UTF-8 or escape a lone surrogate. It
+// covers the strings a parser reads, not those it only skips over.
+//
+// JSON_PARSE_STRING_VIEWS makes keys and strings without escapes point into
+// the input instead of being copied, so the input must outlive the tree.
+// Views are not NUL-terminated; read them with json_query_string_len.
+// json_from_file_ex ignores it since the file is closed after parsing, while
+// json_document_from_file_ex keeps the mapping open until the document is
+// freed.
+//
+// JSON_PARSE_PARALLEL parses a top-level array of at least
+// JSON_PARALLEL_MIN_SIZE bytes on threads, p->threads of them or one per
+// core when zero. Smaller inputs and other roots are parsed as usual.
+//
+// JSON_PARSE_LAZY applies to documents and JSON Lines batches. Objects and
+// arrays are only scanned for their extent at parse time and are parsed one
+// level deep the first time json_get, json_geti or a printer reaches them,
+// so the input must outlive the tree as with views. The grammar is checked
+// up front, escapes and string encoding only when a container is parsed. A
+// container that fails then, or runs out of memory, reads as empty and
+// json_document_error reports the first such failure. Materializing
+// writes to the tree, so lazy trees must not be shared between threads.
+//
+// The tree, tape and SAX parsers accept at most p->max_depth levels of
+// nesting, JSON_DEFAULT_MAX_DEPTH when zero, and fail deeper input with
+// JSON_ERROR_DEPTH, as does the stream parser with the limit given to
+// json_stream_set_max_depth. None of them, nor json_free or the writers,
+// recurse.
+//
+// Keys are interned when p->intern is set: every occurrence of a key then
+// shares one copy owned by the table, which must outlive the trees, and
+// json_get matches a key passed as that same pointer without comparing
+// bytes. JSON_PARSE_INTERN_KEYS gives a document its own table when
+// p->intern is NULL. The parallel and JSON Lines workers and lazily
+// materialized containers do not intern, since a table is not thread-safe.
+//
+// Document and JSON Lines trees share one immutable node for each of true,
+// false and null.
+enum {
+    JSON_PARSE_STRING_VIEWS = 1 << 0,
+    JSON_PARSE_PARALLEL = 1 << 1,
+    JSON_PARSE_LAZY = 1 << 2,
+    JSON_PARSE_INTERN_KEYS = 1 << 3,
+    JSON_PARSE_VALIDATE_UTF8 = 1 << 4
+};
+
+// Every allocation goes through JSON_MALLOC, JSON_REALLOC and JSON_FREE,
+// which default to the C library and may be defined, all three together,
+// before the implementation is included. json_set_allocator routes the
+// heap through a json_allocator instead, for the whole process; set it
+// before anything is allocated and restore the default with NULL. Memory the
+// API hands out, such as json_to_string results and json_set_owned keys,
+// comes from and goes back to that heap.
+//
+// p->allocator, when set, backs the arena of a document or JSON Lines batch
+// parsed with p, chunk by chunk, and is kept by it until it is freed, so
+// each document can draw on its own pool. Heap trees ignore it, since
+// json_free has nothing to find it by. Callbacks used by threaded parses
+// must be thread-safe.
+typedef struct {
+    void *(*malloc)(void *user, size_t size);
+    void *(*realloc)(void *user, void *ptr, size_t size);
+    void (*free)(void *user, void *ptr);
+    void *user;
+} json_allocator;
+
+void json_set_allocator(const json_allocator *a);
+
+// After a failed text parse p->error says why, error_offset is the byte of
+// the input where parsing stopped and error_line and error_column give the
+// same place 1-based, columns counted in bytes. All three are zero after a
+// success. Lines are only counted once a parse has failed, and whatever was
+// built up to the error has already been freed. Anything but whitespace
+// after the value is a syntax error, except for json_path_extract, which
+// stops reading at its target.
+typedef struct {
+    const char *cur;
+    const char *end;
+    json_arena *arena;
+    unsigned flags;
+    json_error error;
+    size_t threads;
+    json_intern_table *intern;
+    size_t max_depth;
+    const json_allocator *allocator;
+    size_t error_offset;
+    size_t error_line;
+    size_t error_column;
+} json_parser;
+
+json_intern_table *json_intern_table_new(void);
+const char *json_intern(json_intern_table *t, const char *s, size_t len);
+void json_intern_table_free(json_intern_table **t);
 
 char *json_read_entire_file_to_cstr(const char* path);
 
 json_value *json_from_string(const char *string);
+json_value *json_from_buffer(const char *data, size_t len);
 json_value *json_from_file(const char *path);
+json_value *json_from_string_ex(json_parser *p, const char *string);
+json_value *json_from_buffer_ex(json_parser *p, const char *data, size_t len);
+json_value *json_from_file_ex(json_parser *p, const char *path);
+
+// Documents allocate every node, item buffer and string of the tree from one
+// arena and release it all with json_document_free. Trees owned by a document
+// are read-only: json_set/json_seti ignore them and json_free does nothing.
+json_document *json_document_from_string(const char *string);
+json_document *json_document_from_buffer(const char *data, size_t len);
+json_document *json_document_from_file(const char *path);
+json_document *json_document_from_string_ex(json_parser *p, const char *string);
+json_document *json_document_from_buffer_ex(json_parser *p, const char *data, size_t len);
+json_document *json_document_from_file_ex(json_parser *p, const char *path);
+json_value *json_document_root(json_document *doc);
+json_error json_document_error(json_document *doc);
+void json_document_free(json_document **doc);
+
+// The tape engine parses into a flat array of 64-bit entries instead of a
+// tree of json_value nodes. Values are addressed by their tape index, and
+// lookups that miss return JSON_TAPE_NONE. Inputs are limited to 4 GiB.
+#define JSON_TAPE_NONE ((size_t)-1)
+
+json_tape *json_tape_from_string(const char *string);
+json_tape *json_tape_from_buffer(const char *data, size_t len);
+json_tape *json_tape_from_file(const char *path);
+json_tape *json_tape_from_buffer_ex(json_parser *p, const char *data, size_t len);
+void json_tape_free(json_tape **t);
+
+size_t json_tape_root(json_tape *t);
+size_t json_tape_get(json_tape *t, size_t obj, const char *key);
+size_t json_tape_geti(json_tape *t, size_t arr, size_t index);
+size_t json_tape_count(json_tape *t, size_t i);
+
+json_type json_tape_type(json_tape *t, size_t i);
+const char *json_tape_query_string(json_tape *t, size_t i);
+size_t json_tape_query_string_len(json_tape *t, size_t i);
+double json_tape_query_number(json_tape *t, size_t i);
+int64_t json_tape_query_integer(json_tape *t, size_t i);
+int json_tape_query_boolean(json_tape *t, size_t i);
+
+// json_to_buffer appends the serialization of v to b, growing it
+// geometrically, and returns a pointer to the appended, NUL-terminated text.
+// Reset and reuse one json_buf to serialize many values without allocating.
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} json_buf;
+
+// The stream parser accepts a document in arbitrary chunks, keeping its
+// place across chunk boundaries, and builds the same heap tree as
+// json_from_buffer. json_stream_feed returns 0 once the input is known to be
+// invalid. json_stream_finish returns the root and readies the stream for
+// the next document; after a failure json_stream_error says why and
+// json_stream_reset clears it. json_stream_set_max_depth bounds nesting as
+// p->max_depth does, for every document the stream parses.
+json_stream *json_stream_new(void);
+void json_stream_set_max_depth(json_stream *s, size_t max_depth);
+int json_stream_feed(json_stream *s, const char *chunk, size_t len);
+json_value *json_stream_finish(json_stream *s);
+json_error json_stream_error(json_stream *s);
+void json_stream_reset(json_stream *s);
+void json_stream_free(json_stream **s);
+
+// The SAX parser reports each token to a callback and builds no tree. Keys
+// and strings are passed as spans of the input, or of a decoded copy that
+// lasts for the call when they hold escapes. Callbacks left NULL are
+// skipped; integer falls back to number when unset. A callback returning 0
+// stops the parse with JSON_ERROR_ABORTED.
+typedef struct {
+    int (*object_begin)(void *user);
+    int (*object_end)(void *user);
+    int (*array_begin)(void *user);
+    int (*array_end)(void *user);
+    int (*key)(void *user, const char *key, size_t len);
+    int (*string)(void *user, const char *s, size_t len);
+    int (*number)(void *user, double n);
+    int (*integer)(void *user, int64_t i);
+    int (*boolean)(void *user, int b);
+    int (*null)(void *user);
+} json_sax;
+
+int json_sax_parse(const json_sax *sax, void *user, const char *data, size_t len);
+int json_sax_parse_ex(json_parser *p, const json_sax *sax, void *user, const char *data, size_t len);
+int json_sax_parse_file(const json_sax *sax, void *user, const char *path);
+
+// JSON Lines: one document per '\n'-terminated line, blank lines skipped.
+// json_lines_from_* parse the records on a pool of threads (0 picks one per
+// core), each worker allocating from its own arena, and keep them in input
+// order; lines that fail to parse are NULL and counted by json_lines_failed,
+// and p->error and its position describe the first of them.
+// The trees are read-only like document trees and live until
+// json_lines_free. The reader instead yields one heap tree per call from a
+// FILE*, so input of any size is read in bounded memory; it returns NULL at
+// end of input or, with json_lines_reader_error set, for a bad line, after
+// which reading can continue. Threads need -pthread unless JSON_NO_THREADS
+// is defined.
+json_lines *json_lines_from_buffer(const char *data, size_t len, size_t threads);
+json_lines *json_lines_from_file(const char *path, size_t threads);
+json_lines *json_lines_from_buffer_ex(json_parser *p, const char *data, size_t len, size_t threads);
+json_lines *json_lines_from_file_ex(json_parser *p, const char *path, size_t threads);
+size_t json_lines_count(json_lines *l);
+size_t json_lines_failed(json_lines *l);
+json_value *json_lines_get(json_lines *l, size_t i);
+void json_lines_free(json_lines **l);
+
+json_lines_reader *json_lines_reader_new(FILE *stream);
+json_lines_reader *json_lines_reader_open(const char *path);
+json_value *json_lines_reader_next(json_lines_reader *r);
+json_error json_lines_reader_error(json_lines_reader *r);
+void json_lines_reader_close(json_lines_reader **r);
 
 char* json_to_string(json_value *v);
+char *json_to_buffer(json_buf *b, json_value *v);
+void json_buf_reset(json_buf *b);
+void json_buf_free(json_buf *b);
 void json_print(FILE* stream, json_value *v);
 void json_pretty_print(FILE* stream, json_value *v);
 
+// The binary encoding stores a tree as one position-independent buffer that
+// can be written to disk, mapped back and walked in place. json_to_binary
+// appends the encoding of v to b and returns 1, or 0 leaving b as it was.
+// json_from_binary checks an encoding and rebuilds the tree without parsing
+// a single number; the _ex forms honour JSON_PARSE_STRING_VIEWS, whose
+// strings are NUL-terminated here, and max_depth. Encodings use the byte
+// order of the machine that wrote them and are rejected elsewhere.
+//
+// All words are 64-bit and every value starts 8-byte aligned, at an offset
+// counted from the start of the buffer:
+//
+//   header   "JSNB", version 1, total size
+//   value    tag | payload << 8, then by tag:
+//            null, false, true: nothing
+//            integer, double: the 64-bit number
+//            string: payload bytes and a NUL, padded to 8
+//            array: end, payload element offsets, the elements
+//            object: end, payload entries of key offset, value offset and
+//                    key length | FNV-1a key hash << 32, then each key as a
+//                    string followed by its value
+//
+// where end is the offset just past the container's last child.
+int json_to_binary(json_buf *b, json_value *v);
+json_value *json_from_binary(const void *data, size_t len);
+json_value *json_from_binary_ex(json_parser *p, const void *data, size_t len);
+json_document *json_document_from_binary(const void *data, size_t len);
+json_document *json_document_from_binary_ex(json_parser *p, const void *data, size_t len);
+
+// A snapshot reads the binary encoding in place, so a file written once by
+// json_snapshot_write can be mapped by any number of processes that then
+// share its pages instead of each holding a tree. The file is replaced by
+// rename, which leaves processes that have the old one open undisturbed.
+// Values are addressed by their offset like tape entries and lookups that
+// miss return JSON_SNAPSHOT_NONE; json_snapshot_key gives the key of an
+// object member as a string value and json_snapshot_geti its value. Only
+// the header is checked when opening, but every offset an accessor follows
+// is bounds-checked, so a damaged file reads as missing values rather than
+// faulting. Without mmap the file is read onto the heap.
+#define JSON_SNAPSHOT_NONE ((size_t)-1)
+
+int json_snapshot_write(const char *path, json_value *v);
+json_snapshot *json_snapshot_open(const char *path);
+json_snapshot *json_snapshot_from_buffer(const void *data, size_t len);
+void json_snapshot_close(json_snapshot **s);
+
+size_t json_snapshot_root(json_snapshot *s);
+size_t json_snapshot_get(json_snapshot *s, size_t obj, const char *key);
+size_t json_snapshot_geti(json_snapshot *s, size_t v, size_t index);
+size_t json_snapshot_key(json_snapshot *s, size_t obj, size_t index);
+size_t json_snapshot_count(json_snapshot *s, size_t v);
+
+json_type json_snapshot_type(json_snapshot *s, size_t v);
+const char *json_snapshot_query_string(json_snapshot *s, size_t v);
+size_t json_snapshot_query_string_len(json_snapshot *s, size_t v);
+double json_snapshot_query_number(json_snapshot *s, size_t v);
+int64_t json_snapshot_query_integer(json_snapshot *s, size_t v);
+int json_snapshot_query_is_integer(json_snapshot *s, size_t v);
+int json_snapshot_query_boolean(json_snapshot *s, size_t v);
+
+// A writer serializes into a buffer of about JSON_WRITER_BUFFER_SIZE bytes
+// and drains it into a sink, so output of any size costs one write per
+// buffer. json_write_pretty indents by indent spaces per level, 4 after
+// init. Nothing reaches the sink until the buffer fills or
+// json_writer_flush; json_writer_free discards what is left. After a failed
+// write, error says why and every later call fails.
+typedef int (*json_write_fn)(void *user, const char *data, size_t len);
+
+typedef struct {
+    json_buf buf;
+    json_write_fn write;
+    void *user;
+    int indent;
+    json_error error;
+} json_writer;
+
+void json_writer_init(json_writer *w, json_write_fn write, void *user);
+void json_writer_init_file(json_writer *w, FILE *stream);
+void json_writer_init_fd(json_writer *w, int fd);
+int json_write(json_writer *w, json_value *v);
+int json_write_pretty(json_writer *w, json_value *v);
+int json_write_raw(json_writer *w, const char *data, size_t len);
+int json_writer_flush(json_writer *w);
+void json_writer_free(json_writer *w);
+
 void json_free(json_value **root);
 
+// json_clone copies v into a heap tree of its own. json_document_clone
+// copies it into a document in a single allocation, sized by a first pass
+// over v. json_equal compares by value, taking object members in any order
+// and integral numbers as equal however written, so that 1 equals 1.0, and
+// stops at the first difference. json_hash agrees with it: equal trees hash
+// alike whatever their key order. Strings are compared as stored. Lazy
+// containers are materialized.
+json_value *json_clone(json_value *v);
+json_document *json_document_clone(json_value *v);
+int json_equal(json_value *a, json_value *b);
+uint64_t json_hash(json_value *v);
+
 json_value *json_get(json_value *obj, const char *key);
 json_value *json_geti(json_value *arr, size_t index);
 void json_set(json_value *obj, const char *key, json_value *val);
 void json_seti(json_value *arr, size_t index, json_value *val);
+void json_object_index(json_value *obj);
+
+// Builders for heap trees. json_set_owned stores key, which must come from
+// the library's heap, instead of a copy, freeing it if the key was already present.
+// json_reserve makes room for n members or elements in total, so the
+// pushes up to n do not reallocate. All return 0 on failure, when val,
+// vals and key stay with the caller, and for read-only trees.
+int json_set_owned(json_value *obj, char *key, json_value *val);
+int json_reserve(json_value *v, size_t n);
+int json_push(json_value *arr, json_value *val);
+int json_push_many(json_value *arr, json_value **vals, size_t n);
+
+// RFC 6901 JSON Pointers such as "/a/0/b", where "~1" stands for '/' and
+// "~0" for '~' within a token and "" is the whole document. A compiled path
+// can be evaluated against any number of trees, or by json_path_extract
+// straight from text, which skips every subtree off the path without
+// building it and stops reading once the target is parsed. Lookups that
+// find nothing return NULL; extraction also sets p->error if the input
+// proves invalid on the way. Keys are compared decoded, as in a tree.
+json_value *json_pointer_get(json_value *root, const char *pointer);
+json_path *json_path_compile(const char *pointer);
+json_value *json_path_get(const json_path *path, json_value *root);
+json_value *json_path_extract(const json_path *path, const char *data, size_t len);
+json_value *json_path_extract_ex(json_parser *p, const json_path *path, const char *data, size_t len);
+json_value *json_path_extract_file(const json_path *path, const char *filename);
+void json_path_free(json_path **path);
+
+// Schemas parse an object of known shape straight into a C struct, without
+// building a tree. Each field names a key and where its value goes in the
+// struct: offset bytes in. JSON_FIELD_BOOL stores an int and
+// JSON_FIELD_CHARS copies into a char[size] inside the struct.
+// JSON_FIELD_STRING stores a heap copy and JSON_FIELD_VALUE a heap tree;
+// json_schema_release frees both. JSON_FIELD_OBJECT parses into the nested
+// struct at offset, as described by fields and count. json_schema_new
+// finds a perfect hash for each key table, so a key costs one probe and one
+// compare. Unknown keys are skipped, checking them only for extent and
+// allocating nothing. Absent keys, null values and repeats of a key leave
+// the field as it was. A value of the wrong kind fails with
+// JSON_ERROR_TYPE, and a string longer than its JSON_FIELD_CHARS buffer
+// with JSON_ERROR_TOO_LARGE. Fields already stored stay stored on failure.
+// Keys are compared as written.
+typedef enum {
+    JSON_FIELD_INT64,
+    JSON_FIELD_INT32,
+    JSON_FIELD_DOUBLE,
+    JSON_FIELD_BOOL,
+    JSON_FIELD_STRING,
+    JSON_FIELD_CHARS,
+    JSON_FIELD_OBJECT,
+    JSON_FIELD_VALUE
+} json_field_type;
+
+typedef struct json_field {
+    const char *key;
+    size_t offset;
+    json_field_type type;
+    size_t size;
+    const struct json_field *fields;
+    size_t count;
+} json_field;
+
+json_schema *json_schema_new(const json_field *fields, size_t count);
+int json_schema_parse(const json_schema *s, void *out, const char *data, size_t len);
+int json_schema_parse_ex(json_parser *p, const json_schema *s, void *out, const char *data, size_t len);
+void json_schema_release(const json_schema *s, void *out);
+void json_schema_free(json_schema **s);
+
+// json_remove and json_removei free a member or element and close the gap;
+// json_inserti moves the elements from index on up by one, index may equal
+// the count. All three return 0 for read-only trees and missing targets.
+//
+// json_diff returns an RFC 6902 JSON Patch, a heap array of operations,
+// that turns a into b: members by key and arrays by position after
+// trimming what they share at either end. json_apply_patch carries out
+// add, remove, replace, move, copy and test operations on a heap tree in
+// place, so an update costs in proportion to the patch; root may be
+// replaced. It stops at the first operation that fails, leaving those
+// before it applied, so patch a json_clone when all or nothing matters.
+// json_merge_patch applies an RFC 7396 merge patch the same way. Patches
+// are only read.
+int json_remove(json_value *obj, const char *key);
+int json_removei(json_value *arr, size_t index);
+int json_inserti(json_value *arr, size_t index, json_value *val);
+json_value *json_diff(json_value *a, json_value *b);
+int json_apply_patch(json_value **root, json_value *patch);
+int json_merge_patch(json_value **root, json_value *patch);
 
 json_value *json_new_string(const char *s);
 json_value *json_new_number(double n);
+json_value *json_new_integer(int64_t i);
 json_value *json_new_boolean(int b);
 json_value *json_new_null(void);
 json_value *json_new_object(void);
@@ -39,564 +459,6532 @@ json_value *json_new_array(void);
 
 json_type json_query_type(json_value *v);
 char *json_query_string(json_value *v);
+size_t json_query_string_len(json_value *v);
 double json_query_number(json_value *v);
+int64_t json_query_integer(json_value *v);
+int json_query_is_integer(json_value *v);
 int json_query_boolean(json_value *v);
 
+// Built with JSON_STATS defined, the library counts its work in one
+// process-wide set of counters, so that it can be exported to monitoring.
+// json_stats_get copies them out and json_stats_reset zeroes them. Threads
+// add to the same counters and their times sum. Allocation time covers the
+// whole library, so after a parse-only stretch parse_ns minus alloc_ns is
+// the time spent scanning. Without JSON_STATS none of this exists and
+// nothing is counted.
+#ifdef JSON_STATS
+typedef struct {
+    uint64_t nodes;
+    uint64_t allocations;
+    uint64_t frees;
+    uint64_t bytes_allocated;
+    uint64_t arena_chunks;
+    uint64_t arena_bytes;
+    uint64_t alloc_ns;
+    uint64_t parses;
+    uint64_t bytes_parsed;
+    uint64_t parse_ns;
+    uint64_t writes;
+    uint64_t bytes_written;
+    uint64_t write_ns;
+} json_stats;
+
+void json_stats_get(json_stats *s);
+void json_stats_reset(void);
+#endif
+
 #endif // JSON_H
 
 #ifdef JSON_IMPLEMENTATION
 
 #include <ctype.h>
-#include <stdarg.h>
+#include <locale.h>
+#include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if !defined(JSON_NO_MMAP) && (defined(__unix__) || defined(__APPLE__))
+#define JSON__HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <errno.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <io.h>
+#endif
+
+#if !defined(JSON_NO_THREADS) && (defined(__unix__) || defined(__APPLE__))
+#define JSON__HAVE_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+// Heap nodes come from per-thread slabs, which needs thread-local storage
+// and a destructor to hand the slabs on when a thread exits.
+#if defined(JSON__HAVE_THREADS) && !defined(JSON_NO_NODE_POOL)
+#define JSON__HAVE_NODE_POOL
+#endif
+
+#ifdef JSON_STATS
+#include <time.h>
+#endif
+
+#if !defined(JSON_MALLOC) && !defined(JSON_REALLOC) && !defined(JSON_FREE)
+#define JSON_MALLOC(size) malloc(size)
+#define JSON_REALLOC(ptr, size) realloc(ptr, size)
+#define JSON_FREE(ptr) free(ptr)
+#elif !defined(JSON_MALLOC) || !defined(JSON_REALLOC) || !defined(JSON_FREE)
+#error "JSON_MALLOC, JSON_REALLOC and JSON_FREE must be defined together"
+#endif
+
+#if !defined(JSON_NO_SIMD)
+#if defined(__AVX2__)
+#define JSON__SIMD_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define JSON__SIMD_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define JSON__SIMD_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
 #define JSON_DEFAULT_ARRAY_SIZE 4
 #define JSON_DEFAULT_OBJECT_SIZE 4
+#define JSON_OBJECT_INDEX_THRESHOLD 16
 #define JSON_READ_ENTIRE_FILE_CHUNK (1024*1024)
+#define JSON_ARENA_CHUNK_SIZE (64*1024)
+#define JSON_ARENA_MAX_CHUNK_SIZE (64*1024*1024)
+#define JSON_ARENA_ALIGN 8
+#define JSON_PARALLEL_MIN_SIZE (1024*1024)
+#define JSON_NODE_POOL_SLAB_SIZE (64*1024)
+#define JSON_WRITER_BUFFER_SIZE (64*1024)
+#define JSON_DEFAULT_MAX_DEPTH 10000
+
+#define JSON__FLAG_ARENA 0x1
+#define JSON__FLAG_BORROWED 0x2
+#define JSON__FLAG_INTEGER 0x4
+#define JSON__FLAG_LAZY 0x8
+#define JSON__FLAG_LAZY_VIEWS 0x10
+#define JSON__FLAG_LAZY_UTF8 0x20
+
+#define JSON__NUMBER_BUFFER_SIZE 32
+
+#define JSON__TAPE_ENTRY(tag, payload) (((uint64_t)(unsigned char)(tag) << 56) | (uint64_t)(payload))
+#define JSON__TAPE_TAG(e) ((char)((e) >> 56))
+#define JSON__TAPE_PAYLOAD(e) ((e) & 0x00FFFFFFFFFFFFFFull)
 
 typedef struct json_value json_value;
 
 typedef struct {
     char *key;
     json_value *val;
+    uint32_t key_len : 31;
+    uint32_t key_borrowed : 1;
+    uint32_t hash;
 } kvp;
 
+// Objects with JSON_OBJECT_INDEX_THRESHOLD or more keys get an open-addressed
+// hash index over items. index[0] holds the slot count, a power of two, and
+// each slot holds an item position plus one, or zero when empty. Item hashes
+// are only filled in while an index exists.
+//
+// Item buffers are allocated on the first push. Counts are 32-bit to keep
+// a node at 32 bytes, which leaves an array room for one item inline.
 struct json_object {
-    size_t count;
-    size_t cap;
     kvp *items;
+    union {
+        uint32_t *index;
+        json_value *up;
+    };
+    uint32_t count;
+    uint32_t cap;
 };
 
 struct json_array {
-    size_t count;
-    size_t cap;
     json_value **items;
+    uint32_t count;
+    uint32_t cap;
+    json_value *small[1];
 };
 
 struct json_value {
     json_type type;
+    unsigned flags;
     union {
         struct json_object object;
         struct json_array array;
-        char *string;
+        struct {
+            char *data;
+            size_t len;
+        } string;
         double number;
+        int64_t integer;
         int boolean;
+        struct {
+            const char *data;
+            size_t len;
+            json_arena *arena;
+        } lazy;
     };
 };
 
-static const char *json_buffer = {0};
+struct json_arena_chunk {
+    struct json_arena_chunk *next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+// error records the first lazy container in the arena that failed to
+// materialize.
+struct json_arena {
+    struct json_arena_chunk *head;
+    const json_allocator *allocator;
+    json_error error;
+};
+
+struct json_document {
+    json_arena arena;
+    json_intern_table *intern;
+    json_value *root;
+    const char *source;
+    size_t source_size;
+    int source_mapped;
+};
+
+typedef struct {
+    const char *data;
+    size_t size;
+    int mapped;
+} json__file;
+
+struct json_tape {
+    uint64_t *tape;
+    size_t count;
+    size_t cap;
+    char *strings;
+    size_t strings_len;
+    size_t strings_cap;
+};
+
+static json_value *json__parse_value(json_parser *p);
+
+// Read-only trees share these. JSON__FLAG_ARENA keeps json_free and the
+// setters away from them.
+static json_value json__true = {.type = JSON_BOOL, .flags = JSON__FLAG_ARENA, .boolean = 1};
+static json_value json__false = {.type = JSON_BOOL, .flags = JSON__FLAG_ARENA, .boolean = 0};
+static json_value json__null = {.type = JSON_NULL, .flags = JSON__FLAG_ARENA};
+
+#ifdef JSON_STATS
+static json_stats json__stats;
 
-static json_value *json__parse_value();
+#if defined(__GNUC__) || defined(__clang__)
+#define JSON__STATS_ADD(field, n) __atomic_fetch_add(&json__stats.field, (uint64_t)(n), __ATOMIC_RELAXED)
+#else
+#define JSON__STATS_ADD(field, n) (json__stats.field += (uint64_t)(n))
+#endif
+#define JSON__STATS_CLOCK(t) uint64_t t = json__stats_now()
+#define JSON__STATS_ELAPSED(field, t) JSON__STATS_ADD(field, json__stats_now() - (t))
 
-static void json__skip_whitespace() {
-    while(isspace(*json_buffer))
-        json_buffer++;
+static uint64_t json__stats_now(void) {
+    struct timespec ts;
+#if defined(__unix__) || defined(__APPLE__)
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
 }
 
-static json_value *json__new_value(json_type t) {
-    json_value *x = malloc(sizeof* x);
-    x->type = t;
-    if (t == JSON_OBJECT) {
-        x->object.count = 0;
-        x->object.cap = 4;
-        x->object.items = malloc(JSON_DEFAULT_OBJECT_SIZE*sizeof *x->object.items);
+void json_stats_get(json_stats *s) {
+    uint64_t *from = (uint64_t *)&json__stats;
+    uint64_t *to = (uint64_t *)s;
+    for (size_t i = 0; i < sizeof *s / sizeof *to; i++) {
+#if defined(__GNUC__) || defined(__clang__)
+        to[i] = __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+#else
+        to[i] = from[i];
+#endif
     }
-    if (t == JSON_ARRAY) {
-        x->array.count = 0;
-        x->array.cap = 4;
-        x->array.items = malloc(JSON_DEFAULT_ARRAY_SIZE*sizeof *x->array.items);
+}
+
+void json_stats_reset(void) {
+    uint64_t *c = (uint64_t *)&json__stats;
+    for (size_t i = 0; i < sizeof json__stats / sizeof *c; i++) {
+#if defined(__GNUC__) || defined(__clang__)
+        __atomic_store_n(&c[i], 0, __ATOMIC_RELAXED);
+#else
+        c[i] = 0;
+#endif
     }
+}
+#else
+#define JSON__STATS_ADD(field, n) ((void)0)
+#define JSON__STATS_CLOCK(t) ((void)0)
+#define JSON__STATS_ELAPSED(field, t) ((void)0)
+#endif
+
+static json_allocator json__allocator;
+
+void json_set_allocator(const json_allocator *a) {
+    json__allocator = a ? *a : (json_allocator){NULL, NULL, NULL, NULL};
+}
+
+static void *json__heap_alloc(size_t size) {
+    JSON__STATS_CLOCK(t);
+    void *x = json__allocator.malloc ? json__allocator.malloc(json__allocator.user, size) : JSON_MALLOC(size);
+    JSON__STATS_ADD(allocations, 1);
+    JSON__STATS_ADD(bytes_allocated, size);
+    JSON__STATS_ELAPSED(alloc_ns, t);
     return x;
 }
 
-static char *json__parse_string() {
-    json_buffer++;
-    const char *s = json_buffer;
-    while(*json_buffer!='"' && !(*json_buffer == '\\' && *(json_buffer+1) == '"'))
-        json_buffer++;
-    size_t l = json_buffer - s;
-    char* x = malloc(l + 1);
-    for(size_t i = 0; i < l; i++)
-        x[i] = s[i];
-    x[l] = '\0';
-    json_buffer++;
+static void *json__heap_realloc(void *ptr, size_t size) {
+    JSON__STATS_CLOCK(t);
+    void *x = json__allocator.realloc ? json__allocator.realloc(json__allocator.user, ptr, size)
+                                      : JSON_REALLOC(ptr, size);
+    JSON__STATS_ADD(allocations, 1);
+    JSON__STATS_ADD(bytes_allocated, size);
+    JSON__STATS_ELAPSED(alloc_ns, t);
     return x;
 }
 
-static double json__parse_number() {
-    char *e;
-    double v = strtod(json_buffer, &e);
-    json_buffer = e;
-    return v;
+static void json__heap_free(void *ptr) {
+    if (!ptr)
+        return;
+    JSON__STATS_ADD(frees, 1);
+    if (json__allocator.free)
+        json__allocator.free(json__allocator.user, ptr);
+    else
+        JSON_FREE(ptr);
 }
 
-static json_value *json__parse_array() {
-    json_buffer++;
-    json_value *x = json__new_value(JSON_ARRAY);
-    json__skip_whitespace();
-    if(*json_buffer == ']') {
-        json_buffer++;
-        return x;
-    }
-    while (1) {
-        json__skip_whitespace();
-        json_value *e = json__parse_value();
-        x->array.items[x->array.count++] = e;
-        if(x->array.count == x->array.cap)
-            x->array.items = realloc(x->array.items,(x->array.cap *= 2)*sizeof*x->array.items);
-        json__skip_whitespace();
-        if(*json_buffer == ',') {
-            json_buffer++;
-            continue;
-        } if (*json_buffer == ']') {
-            json_buffer++;
-            break;
-        }
-    }
+static void *json__heap_calloc(size_t n, size_t size) {
+    if (size && n > SIZE_MAX / size)
+        return NULL;
+    void *x = json__heap_alloc(n * size);
+    if (x)
+        memset(x, 0, n * size);
     return x;
 }
 
-static json_value *json__parse_object() {
-    json_buffer++;
-    json_value *x = json__new_value(JSON_OBJECT);
-    json__skip_whitespace();
-    if(*json_buffer == '}') {
-        json_buffer++;
+// Arena chunks come from the arena's own allocator when it has one.
+static void *json__chunk_alloc(json_arena *a, size_t size) {
+    JSON__STATS_ADD(arena_chunks, 1);
+    JSON__STATS_ADD(arena_bytes, size);
+    if (a->allocator) {
+        JSON__STATS_CLOCK(t);
+        void *x = a->allocator->malloc(a->allocator->user, size);
+        JSON__STATS_ADD(allocations, 1);
+        JSON__STATS_ADD(bytes_allocated, size);
+        JSON__STATS_ELAPSED(alloc_ns, t);
         return x;
     }
-    while (1) {
-        json__skip_whitespace();
+    return json__heap_alloc(size);
+}
 
-        if(*json_buffer != '"')
-            return NULL;
+static void json__chunk_free(json_arena *a, void *ptr) {
+    if (a->allocator) {
+        JSON__STATS_ADD(frees, 1);
+        a->allocator->free(a->allocator->user, ptr);
+    } else {
+        json__heap_free(ptr);
+    }
+}
 
-        char *k = json__parse_string();
-        json__skip_whitespace();
+static size_t json__arena_align(size_t size) {
+    return (size + JSON_ARENA_ALIGN - 1) & ~(size_t)(JSON_ARENA_ALIGN - 1);
+}
 
-        if (*json_buffer != ':')
+static void *json__arena_alloc(json_arena *a, size_t size) {
+    size = json__arena_align(size);
+    struct json_arena_chunk *c = a->head;
+    if (!c || c->size - c->used < size) {
+        size_t cap = c ? c->size * 2 : JSON_ARENA_CHUNK_SIZE;
+        if (cap > JSON_ARENA_MAX_CHUNK_SIZE)
+            cap = JSON_ARENA_MAX_CHUNK_SIZE;
+        if (cap < size)
+            cap = size;
+        c = json__chunk_alloc(a, sizeof *c + cap);
+        if (!c)
             return NULL;
-        json_buffer++;
-        json__skip_whitespace();
-        json_value *v = json__parse_value();
-        if(x->object.count == x->object.cap)
-            x->object.items = realloc(x->object.items, (x->object.cap *= 2)*sizeof *x->object.items);
-        x->object.items[x->object.count++] = (kvp){k,v};
-        json__skip_whitespace();
-        if(*json_buffer == ','){
-            json_buffer++;
-            continue;
-        } 
-        if (*json_buffer == '}') {
-            json_buffer++;
-            break;
-        }
+        c->next = a->head;
+        c->size = cap;
+        c->used = 0;
+        a->head = c;
     }
+    void *x = c->data + c->used;
+    c->used += size;
     return x;
 }
 
-json_value *json__parse_value() {
-    json__skip_whitespace();
-    if (*json_buffer == '"') {
-        char *s = json__parse_string();
-        json_value *v = json__new_value(JSON_STRING);
-        v->string = s;
-        return v;
-    }
-    if (*json_buffer == '{')
-        return json__parse_object();
-    if(*json_buffer == '[')
-        return json__parse_array();
-    if(strncmp(json_buffer, "true", 4) == 0) {
-        json_buffer += 4;
-        json_value *v = json__new_value(JSON_BOOL);
-        v->boolean = 1;
-        return v;
-    }
-    if(strncmp(json_buffer, "false", 5) == 0) {
-        json_buffer += 5;
-        json_value *v = json__new_value(JSON_BOOL);
-        v->boolean = 0;
-        return v;
-    }
-    if (strncmp(json_buffer, "null", 4) == 0) {
-        json_buffer+=4;
-        return json__new_value(JSON_NULL);
+// Makes room for size bytes in the current chunk, so that many bytes of
+// allocations that follow take no further malloc.
+static int json__arena_reserve(json_arena *a, size_t size) {
+    struct json_arena_chunk *c = a->head;
+    if (c && c->size - c->used >= size)
+        return 1;
+    c = json__chunk_alloc(a, sizeof *c + size);
+    if (!c)
+        return 0;
+    c->next = a->head;
+    c->size = size;
+    c->used = 0;
+    a->head = c;
+    return 1;
+}
+
+// Grows in place when ptr is the most recent allocation, which is the common
+// case for an items buffer whose elements are scalars.
+static void *json__arena_realloc(json_arena *a, void *ptr, size_t old_size, size_t size) {
+    struct json_arena_chunk *c = a->head;
+    if (ptr && c && (char *)ptr + json__arena_align(old_size) == c->data + c->used) {
+        size_t offset = (char *)ptr - c->data;
+        if (json__arena_align(size) <= c->size - offset) {
+            c->used = offset + json__arena_align(size);
+            return ptr;
+        }
     }
-    if(*json_buffer == '-' || isdigit(*json_buffer)) {
-        double n = json__parse_number();
-        json_value *v = json__new_value(JSON_NUMBER);
-        v->number = n;
-        return v;
+    void *x = json__arena_alloc(a, size);
+    if (x && ptr)
+        memcpy(x, ptr, old_size < size ? old_size : size);
+    return x;
+}
+
+static void json__arena_free(json_arena *a) {
+    struct json_arena_chunk *c = a->head;
+    while (c) {
+        struct json_arena_chunk *next = c->next;
+        json__chunk_free(a, c);
+        c = next;
     }
-    return NULL;
+    a->head = NULL;
 }
 
-char *json_read_entire_file_to_cstr(const char* path) {
-    char *data = NULL;
+static void *json__alloc(json_arena *a, size_t size) {
+    return a ? json__arena_alloc(a, size) : json__heap_alloc(size);
+}
 
-    FILE *fin = fopen(path, "rb");
-    if (fin == NULL) {
-        fprintf(stderr, "error, failed to open %s: %s:%d\n", path, __FILE__, __LINE__);
-        return NULL;
-    }
+static void *json__realloc(json_arena *a, void *ptr, size_t old_size, size_t size) {
+    return a ? json__arena_realloc(a, ptr, old_size, size) : json__heap_realloc(ptr, size);
+}
 
-    char *temp = NULL;
-    size_t n = 0;
-    size_t size = 0;
-    size_t used = 0;
-    while (1) {
-        if (used + JSON_READ_ENTIRE_FILE_CHUNK + 1 > size) {
-            size = used + JSON_READ_ENTIRE_FILE_CHUNK + 1;
+static void json__free(json_arena *a, void *ptr) {
+    if (!a)
+        json__heap_free(ptr);
+}
 
-            if (size <= used) {
-                if (data != NULL)
-                    free(data);
-                fclose(fin);
-                fprintf(stderr, "error, failed reading %s into memory becase the file size overflowed the size_t type\n", path);
-                return NULL;
-            }
+static int json__is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
 
-            temp = realloc(data, size);
-            if (temp == NULL) {
-                if (data != NULL)
-                    free(data);
-                fclose(fin);
-                fprintf(stderr, "error, failed to reallocate data (size %zu bytes) to %zu byte container\n", sizeof *data, size);
-                return NULL;
-            }
-            data = temp;
-        }
+#if defined(JSON__SIMD_AVX2) || defined(JSON__SIMD_SSE2) || defined(JSON__SIMD_NEON)
+static unsigned json__ctz(unsigned long long x) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long i;
+    if (_BitScanForward(&i, (unsigned long)x))
+        return (unsigned)i;
+    _BitScanForward(&i, (unsigned long)(x >> 32));
+    return (unsigned)i + 32;
+#else
+    return (unsigned)__builtin_ctzll(x);
+#endif
+}
+#endif
 
-        n = fread(data + used, 1, JSON_READ_ENTIRE_FILE_CHUNK, fin);
-        if (ferror(fin)) {
-            if (data != NULL)
-                free(data);
-            fclose(fin);
-            fprintf(stderr, "error, failed to read chunk of %s into data\n", path);
-            return NULL;
-        }
+// The scanners return the first byte in [cur, end) that stops a string ('"'
+// or '\\') or is not whitespace, or end if there is none. Full blocks go
+// through the widest vector unit the build targets; the tail is scalar.
+static const char *json__scan_string(const char *cur, const char *end) {
+#if defined(JSON__SIMD_AVX2)
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    while (end - cur >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)cur);
+        __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(m);
+        if (mask)
+            return cur + json__ctz(mask);
+        cur += 32;
+    }
+#elif defined(JSON__SIMD_SSE2)
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    while (end - cur >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)cur);
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash));
+        unsigned mask = (unsigned)_mm_movemask_epi8(m);
+        if (mask)
+            return cur + json__ctz(mask);
+        cur += 16;
+    }
+#elif defined(JSON__SIMD_NEON)
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    while (end - cur >= 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t *)cur);
+        uint8x16_t m = vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, backslash));
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+        if (mask)
+            return cur + (json__ctz(mask) >> 2);
+        cur += 16;
+    }
+#endif
+    while (cur < end && *cur != '"' && *cur != '\\')
+        cur++;
+    return cur;
+}
 
-        used += n;
+// Like json__scan_string, but also stops at control characters: the bytes
+// a printer has to escape.
+static const char *json__scan_escape(const char *cur, const char *end) {
+#if defined(JSON__SIMD_AVX2)
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control = _mm256_set1_epi8(0x1F);
+    while (end - cur >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)cur);
+        __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(_mm256_max_epu8(v, control), control));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(m);
+        if (mask)
+            return cur + json__ctz(mask);
+        cur += 32;
+    }
+#elif defined(JSON__SIMD_SSE2)
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1F);
+    while (end - cur >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)cur);
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_max_epu8(v, control), control));
+        unsigned mask = (unsigned)_mm_movemask_epi8(m);
+        if (mask)
+            return cur + json__ctz(mask);
+        cur += 16;
+    }
+#elif defined(JSON__SIMD_NEON)
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    const uint8x16_t control = vdupq_n_u8(0x20);
+    while (end - cur >= 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t *)cur);
+        uint8x16_t m = vorrq_u8(vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, backslash)), vcltq_u8(v, control));
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+        if (mask)
+            return cur + (json__ctz(mask) >> 2);
+        cur += 16;
+    }
+#endif
+    while (cur < end && *cur != '"' && *cur != '\\' && (unsigned char)*cur >= 0x20)
+        cur++;
+    return cur;
+}
 
-        if (feof(fin))
-            break;
+static const char *json__scan_whitespace(const char *cur, const char *end) {
+#if defined(JSON__SIMD_AVX2)
+    while (end - cur >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)cur);
+        __m256i m = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))));
+        unsigned mask = ~(unsigned)_mm256_movemask_epi8(m);
+        if (mask)
+            return cur + json__ctz(mask);
+        cur += 32;
     }
-    fclose(fin);
+#elif defined(JSON__SIMD_SSE2)
+    while (end - cur >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)cur);
+        __m128i m = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))),
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))));
+        unsigned mask = ~(unsigned)_mm_movemask_epi8(m) & 0xFFFF;
+        if (mask)
+            return cur + json__ctz(mask);
+        cur += 16;
+    }
+#elif defined(JSON__SIMD_NEON)
+    while (end - cur >= 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t *)cur);
+        uint8x16_t m = vorrq_u8(
+            vorrq_u8(vceqq_u8(v, vdupq_n_u8(' ')), vceqq_u8(v, vdupq_n_u8('\n'))),
+            vorrq_u8(vceqq_u8(v, vdupq_n_u8('\r')), vceqq_u8(v, vdupq_n_u8('\t'))));
+        uint64_t mask = ~vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+        if (mask)
+            return cur + (json__ctz(mask) >> 2);
+        cur += 16;
+    }
+#endif
+    while (cur < end && json__is_space(*cur))
+        cur++;
+    return cur;
+}
 
-    temp = realloc(data, used+1);
-    if (temp == NULL) {
-        if (data != NULL)
-            free(data);
-        fprintf(stderr, "error, failed to reallocate data (size %zu bytes) to %zu byte container\n", sizeof *data, size);
-        return NULL;
+static void json__skip_whitespace(json_parser *p) {
+    // Most tokens are followed by at most one separator byte, so only runs
+    // of whitespace (indentation) are worth handing to the vector scanner.
+    if (p->cur < p->end && !json__is_space(*p->cur))
+        return;
+    if (p->end - p->cur > 1 && !json__is_space(p->cur[1])) {
+        p->cur++;
+        return;
     }
-    data = temp;
-    data[used] = '\0';
-    return data;
+    p->cur = json__scan_whitespace(p->cur, p->end);
 }
 
-json_value *json_from_string(const char *string) {
-    json_buffer = string;
-    return json__parse_value();
+static uint32_t json__hash(const char *s, size_t l) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < l; i++)
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
+    return h;
 }
 
-json_value *json_from_file(const char *path) {
-    char *string = json_read_entire_file_to_cstr(path);
-    if (!string)
-        return NULL;
-    json_buffer = string;
-    json_value *value = json__parse_value();
-    free(string);
-    json_buffer = NULL;
-    return value;
+static void json__object_index_insert(struct json_object *o, size_t i) {
+    size_t mask = o->index[0] - 1;
+    size_t j = o->items[i].hash & mask;
+    while (o->index[1 + j])
+        j = (j + 1) & mask;
+    o->index[1 + j] = (uint32_t)(i + 1);
 }
 
-void json_free(json_value **root) {
-    if(!root || !*root)
-        return; 
+// Sized to keep the load factor at or below one half.
+static int json__object_build_index(json_arena *a, struct json_object *o) {
+    size_t slots = 2 * JSON_OBJECT_INDEX_THRESHOLD;
+    while (slots < 2 * o->count + 2)
+        slots *= 2;
+    if (slots > UINT32_MAX)
+        return 0;
+    uint32_t *index = json__alloc(a, (1 + slots) * sizeof *index);
+    if (!index)
+        return 0;
+    memset(index, 0, (1 + slots) * sizeof *index);
+    index[0] = (uint32_t)slots;
+    json__free(a, o->index);
+    o->index = index;
+    for (size_t i = 0; i < o->count; i++) {
+        o->items[i].hash = json__hash(o->items[i].key, o->items[i].key_len);
+        json__object_index_insert(o, i);
+    }
+    return 1;
+}
 
-    json_value *r = *root;
-    switch (r->type) {
-        case JSON_OBJECT:
-            for(size_t i = 0; i < r->object.count; i++) {
-                free(r->object.items[i].key);
-                json_free(&r->object.items[i].val);
-            }
-            free(r->object.items);
-            break;
-        case JSON_ARRAY:
-            for(size_t i = 0; i < r->array.count; i++)
-                json_free(&r->array.items[i]);
-            free(r->array.items);
-            break;
-        case JSON_STRING:
-            free(r->string);
-            break;
-        default:
-            break;
+static kvp *json__object_find_hashed(struct json_object *o, const char *key, size_t l, uint32_t h) {
+    if (o->index) {
+        size_t mask = o->index[0] - 1;
+        for (size_t j = h & mask; o->index[1 + j]; j = (j + 1) & mask) {
+            kvp *e = &o->items[o->index[1 + j] - 1];
+            if (e->hash == h && e->key_len == l && (e->key == key || memcmp(e->key, key, l) == 0))
+                return e;
+        }
+        return NULL;
     }
-    free(r);
-    *root = NULL;
+    for (size_t i = 0; i < o->count; i++)
+        if (o->items[i].key_len == l && (o->items[i].key == key || memcmp(o->items[i].key, key, l) == 0))
+            return &o->items[i];
+    return NULL;
 }
 
-void json_print(FILE *stream, json_value *v) {
-    if (!v)
-        return;
+static kvp *json__object_find(struct json_object *o, const char *key, size_t l) {
+    return json__object_find_hashed(o, key, l, o->index ? json__hash(key, l) : 0);
+}
 
-    switch (v->type) {
-        case JSON_OBJECT:
-            fprintf(stream, "{");
-            for(size_t i = 0; i < v->object.count; i++) {
-                fprintf(stream, "\"%s\":",v->object.items[i].key);
-                json_print(stream, v->object.items[i].val);
-                if(i+1 < v->object.count)
-                    fprintf(stream, ",");
-            }
-            fprintf(stream, "}");
-            break;
-        case JSON_ARRAY:
-            fprintf(stream, "[");
-            for(size_t i = 0; i < v->array.count; i++) {
-                json_print(stream, v->array.items[i]);
-                if(i + 1 < v->array.count)
-                    fprintf(stream, ",");
-            }
-            fprintf(stream, "]");
-            break;
-        case JSON_STRING:
-            fprintf(stream, "\"%s\"", v->string);
-            break;
-        case JSON_NUMBER:
-            fprintf(stream, "%g", v->number);
-            break;
-        case JSON_BOOL:
-            fprintf(stream, v->boolean ? "true" : "false");
-            break;
-        case JSON_NULL:
-            fprintf(stream, "null");
-            break;
+// The first item of an array lives in the node itself, the buffer coming
+// in only with the second.
+static int json__array_push(json_arena *a, struct json_array *arr, json_value *v) {
+    if (arr->count == arr->cap) {
+        json_value **items;
+        if (!arr->cap) {
+            arr->items = arr->small;
+            arr->cap = 1;
+        } else if (arr->items == arr->small) {
+            items = json__alloc(a, JSON_DEFAULT_ARRAY_SIZE * sizeof *items);
+            if (!items)
+                return 0;
+            items[0] = arr->small[0];
+            arr->items = items;
+            arr->cap = JSON_DEFAULT_ARRAY_SIZE;
+        } else {
+            if (arr->cap > UINT32_MAX / 2)
+                return 0;
+            size_t old_size = arr->cap * sizeof *arr->items;
+            items = json__realloc(a, arr->items, old_size, 2 * old_size);
+            if (!items)
+                return 0;
+            arr->items = items;
+            arr->cap *= 2;
+        }
     }
+    arr->items[arr->count++] = v;
+    return 1;
 }
 
-static void json__pretty_printer(FILE* stream, json_value *v, int indent_level) {
-    if (!v)
-        return;
+static int json__object_push(json_arena *a, struct json_object *o, kvp e) {
+    if (o->count == o->cap) {
+        if (o->cap > UINT32_MAX / 2)
+            return 0;
+        size_t old_size = o->cap * sizeof *o->items;
+        size_t size = o->cap ? 2 * old_size : JSON_DEFAULT_OBJECT_SIZE * sizeof *o->items;
+        kvp *items = json__realloc(a, o->items, old_size, size);
+        if (!items)
+            return 0;
+        o->items = items;
+        o->cap = (uint32_t)(size / sizeof *items);
+    }
+    o->items[o->count++] = e;
+    return 1;
+}
 
-#define PRINT_INDENT for(int i=0; i<indent_level; i++) fprintf(stream, "    ")
+#ifdef JSON__HAVE_NODE_POOL
+typedef union json__pool_node {
+    union json__pool_node *next;
+    json_value value;
+} json__pool_node;
 
-    switch (v->type) {
-        case JSON_OBJECT:
-            fprintf(stream, "{\n");
-            for(size_t i = 0; i < v->object.count; i++) {
-                PRINT_INDENT;
-                fprintf(stream, "    \"%s\": ", v->object.items[i].key);
-                json__pretty_printer(stream, v->object.items[i].val, indent_level + 1);
-                if(i + 1 < v->object.count)
-                    fprintf(stream, ",");
-                fprintf(stream, "\n");
-            }
-            PRINT_INDENT;
-            fprintf(stream, "}");
-            break;
-        case JSON_ARRAY:
-            fprintf(stream, "[\n");
-            for(size_t i = 0; i < v->array.count; i++) {
-                PRINT_INDENT;
-                fprintf(stream, "    ");
-                json__pretty_printer(stream, v->array.items[i], indent_level + 1);
-                if(i + 1 < v->array.count)
-                    fprintf(stream, ",");
-                fprintf(stream, "\n");
-            }
-            PRINT_INDENT;
-            fprintf(stream, "]");
-            break;
-        case JSON_STRING:
-            fprintf(stream, "\"%s\"", v->string);
-            break;
-        case JSON_NUMBER:
-            fprintf(stream, "%g", v->number);
-            break;
-        case JSON_BOOL:
-            fprintf(stream, v->boolean ? "true" : "false");
-            break;
-        case JSON_NULL:
-            fprintf(stream, "null");
-            break;
-    }
+// Slabs are aligned to their size, a power of two, so a node finds its slab,
+// and through it the owning pool, by masking its address.
+typedef struct json__pool_slab {
+    struct json__pool_slab *next;
+    struct json__node_pool *pool;
+    void *block;
+    json__pool_node nodes[];
+} json__pool_slab;
 
-    #undef PRINT_INDENT
-}
+#define JSON__POOL_SLAB_NODES ((JSON_NODE_POOL_SLAB_SIZE - sizeof(json__pool_slab)) / sizeof(json__pool_node))
 
-void json_pretty_print(FILE* stream, json_value *v) {
-    json__pretty_printer(stream, v, 0);
-    fprintf(stream, "\n");
-}
+// Nodes freed by another thread are pushed onto the owner's returned list
+// and taken back when its free list runs dry. A pool whose nodes are all
+// back is released when its thread exits; otherwise it is orphaned and
+// adopted by the next thread that needs one.
+typedef struct json__node_pool {
+    struct json__node_pool *next;
+    json__pool_node *free;
+    json__pool_node *returned;
+    json__pool_slab *slabs;
+    size_t used;
+    size_t live;
+    size_t remote;
+} json__node_pool;
 
-static void json__append_string(char **buffer, size_t *buf_size, size_t *pos, const char *fmt, ...) {
-    va_list args;
-    va_start(args, fmt);
+static pthread_key_t json__node_pool_key;
+static pthread_once_t json__node_pool_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t json__node_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static json__node_pool *json__node_pool_orphans;
+static _Thread_local json__node_pool *json__node_pool_local;
 
-    int needed = vsnprintf(NULL, 0, fmt, args);
-    if (needed < 0) {
-        va_end(args);
+static void json__node_pool_exit(void *arg) {
+    json__node_pool *pool = arg;
+    json__node_pool_local = NULL;
+    if (pool->live == __atomic_load_n(&pool->remote, __ATOMIC_ACQUIRE)) {
+        json__pool_slab *slab = pool->slabs;
+        while (slab) {
+            json__pool_slab *next = slab->next;
+            json__heap_free(slab->block);
+            slab = next;
+        }
+        json__heap_free(pool);
         return;
     }
+    pthread_mutex_lock(&json__node_pool_lock);
+    pool->next = json__node_pool_orphans;
+    json__node_pool_orphans = pool;
+    pthread_mutex_unlock(&json__node_pool_lock);
+}
 
-    if (*pos + needed + 1 > *buf_size) {
-        *buf_size = *pos + needed + 1;
-        *buffer = realloc(*buffer, *buf_size);
-        if (!*buffer) {
-            va_end(args);
-            return;
-        }
-    }
+static void json__node_pool_init(void) {
+    pthread_key_create(&json__node_pool_key, json__node_pool_exit);
+}
 
-    vsnprintf(*buffer + *pos, *buf_size - *pos, fmt, args);
-    *pos += needed;
-    va_end(args);
+static json__node_pool *json__node_pool_get(void) {
+    json__node_pool *pool = json__node_pool_local;
+    if (pool)
+        return pool;
+    pthread_once(&json__node_pool_once, json__node_pool_init);
+    pthread_mutex_lock(&json__node_pool_lock);
+    pool = json__node_pool_orphans;
+    if (pool)
+        json__node_pool_orphans = pool->next;
+    pthread_mutex_unlock(&json__node_pool_lock);
+    if (!pool) {
+        pool = json__heap_calloc(1, sizeof *pool);
+        if (!pool)
+            return NULL;
+        pool->used = JSON__POOL_SLAB_NODES;
+    }
+    pthread_setspecific(json__node_pool_key, pool);
+    json__node_pool_local = pool;
+    return pool;
 }
+#endif
 
-static void json__to_string_helper(json_value *v, char **buffer, size_t *buf_size, size_t *pos) {
-    if (!v)
-        return;
+static json_value *json__node_alloc(void) {
+#ifdef JSON__HAVE_NODE_POOL
+    json__node_pool *pool = json__node_pool_get();
+    if (!pool)
+        return NULL;
+    if (!pool->free && __atomic_load_n(&pool->returned, __ATOMIC_RELAXED))
+        pool->free = __atomic_exchange_n(&pool->returned, NULL, __ATOMIC_ACQUIRE);
+    if (pool->free) {
+        json__pool_node *n = pool->free;
+        pool->free = n->next;
+        pool->live++;
+        return &n->value;
+    }
+    if (pool->used == JSON__POOL_SLAB_NODES) {
+        // Over-allocate to align; the unused part is never touched.
+        char *block = json__heap_alloc(2 * JSON_NODE_POOL_SLAB_SIZE);
+        if (!block)
+            return NULL;
+        json__pool_slab *slab = (json__pool_slab *)(block + (JSON_NODE_POOL_SLAB_SIZE -
+            (uintptr_t)block % JSON_NODE_POOL_SLAB_SIZE) % JSON_NODE_POOL_SLAB_SIZE);
+        slab->block = block;
+        slab->pool = pool;
+        slab->next = pool->slabs;
+        pool->slabs = slab;
+        pool->used = 0;
+    }
+    pool->live++;
+    return &pool->slabs->nodes[pool->used++].value;
+#else
+    return json__heap_alloc(sizeof(json_value));
+#endif
+}
+
+static void json__node_release(json_value *v) {
+#ifdef JSON__HAVE_NODE_POOL
+    json__pool_node *n = (json__pool_node *)v;
+    json__pool_slab *slab = (json__pool_slab *)((uintptr_t)v & ~(uintptr_t)(JSON_NODE_POOL_SLAB_SIZE - 1));
+    json__node_pool *pool = slab->pool;
+    if (pool == json__node_pool_local) {
+        n->next = pool->free;
+        pool->free = n;
+        pool->live--;
+        return;
+    }
+    n->next = __atomic_load_n(&pool->returned, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&pool->returned, &n->next, n, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    // Counted last: once it matches the owner's count the pool may be freed.
+    __atomic_fetch_add(&pool->remote, 1, __ATOMIC_RELEASE);
+#else
+    json__heap_free(v);
+#endif
+}
+
+typedef struct {
+    const char *s;
+    uint32_t len;
+    uint32_t hash;
+} json__intern_slot;
+
+struct json_intern_table {
+    json_arena strings;
+    json__intern_slot *slots;
+    size_t count;
+    size_t cap;
+};
+
+json_intern_table *json_intern_table_new(void) {
+    return json__heap_calloc(1, sizeof(json_intern_table));
+}
+
+static int json__intern_grow(json_intern_table *t) {
+    size_t cap = t->cap ? t->cap * 2 : 256;
+    json__intern_slot *slots = json__heap_calloc(cap, sizeof *slots);
+    if (!slots)
+        return 0;
+    for (size_t i = 0; i < t->cap; i++) {
+        if (!t->slots[i].s)
+            continue;
+        size_t j = t->slots[i].hash & (cap - 1);
+        while (slots[j].s)
+            j = (j + 1) & (cap - 1);
+        slots[j] = t->slots[i];
+    }
+    json__heap_free(t->slots);
+    t->slots = slots;
+    t->cap = cap;
+    return 1;
+}
+
+const char *json_intern(json_intern_table *t, const char *s, size_t len) {
+    if (len > INT32_MAX)
+        return NULL;
+    if (2 * (t->count + 1) > t->cap && !json__intern_grow(t))
+        return NULL;
+    uint32_t h = json__hash(s, len);
+    size_t j = h & (t->cap - 1);
+    for (; t->slots[j].s; j = (j + 1) & (t->cap - 1)) {
+        json__intern_slot *e = &t->slots[j];
+        if (e->hash == h && e->len == len && memcmp(e->s, s, len) == 0)
+            return e->s;
+    }
+    char *x = json__arena_alloc(&t->strings, len + 1);
+    if (!x)
+        return NULL;
+    memcpy(x, s, len);
+    x[len] = '\0';
+    t->slots[j] = (json__intern_slot){x, (uint32_t)len, h};
+    t->count++;
+    return x;
+}
+
+void json_intern_table_free(json_intern_table **t) {
+    if (!t || !*t)
+        return;
+
+    json__arena_free(&(*t)->strings);
+    json__heap_free((*t)->slots);
+    json__heap_free(*t);
+    *t = NULL;
+}
+
+static json_value *json__new_value(json_arena *a, json_type t) {
+    json_value *x = a ? json__arena_alloc(a, sizeof *x) : json__node_alloc();
+    if (!x)
+        return NULL;
+    JSON__STATS_ADD(nodes, 1);
+    x->type = t;
+    x->flags = a ? JSON__FLAG_ARENA : 0;
+    if (t == JSON_OBJECT)
+        x->object = (struct json_object){NULL, {NULL}, 0, 0};
+    if (t == JSON_ARRAY)
+        x->array = (struct json_array){NULL, 0, 0, {NULL}};
+    return x;
+}
+
+// Advances from just past an opening quote to its closing quote, recording
+// in *escaped whether a backslash was seen on the way. A raw control
+// character fails the string, leaving p->cur on it.
+static int json__skip_string(json_parser *p, int *escaped) {
+    *escaped = 0;
+    while((p->cur = json__scan_escape(p->cur, p->end)) < p->end && *p->cur != '"') {
+        if (*p->cur != '\\')
+            break;
+        *escaped = 1;
+        if (p->end - p->cur > 1)
+            p->cur++;
+        p->cur++;
+    }
+    if (p->cur >= p->end || *p->cur != '"') {
+        p->error = JSON_ERROR_SYNTAX;
+        return 0;
+    }
+    return 1;
+}
+
+// Returns the first byte of [s, end) that is a control character or breaks
+// UTF-8, overlong forms, surrogates and code points past U+10FFFF included,
+// or end. Printable ASCII is cleared eight bytes at a time.
+static const char *json__utf8_scan(const char *s, const char *end) {
+    const unsigned char *c = (const unsigned char *)s;
+    const unsigned char *e = (const unsigned char *)end;
+    while (c < e) {
+        if (e - c >= 8) {
+            uint64_t w;
+            memcpy(&w, c, sizeof w);
+            // With every top bit clear, adding 0x60 sets it exactly in the
+            // bytes from 0x20 up and never carries between bytes.
+            if (!(w & 0x8080808080808080ull) &&
+                ((w + 0x6060606060606060ull) & 0x8080808080808080ull) == 0x8080808080808080ull) {
+                c += 8;
+                continue;
+            }
+        }
+        if (*c < 0x20)
+            break;
+        if (*c < 0x80) {
+            c++;
+            continue;
+        }
+        size_t n;
+        unsigned char lo = 0x80, hi = 0xBF;
+        if (*c >= 0xC2 && *c <= 0xDF) {
+            n = 1;
+        } else if (*c >= 0xE0 && *c <= 0xEF) {
+            n = 2;
+            if (*c == 0xE0)
+                lo = 0xA0;
+            else if (*c == 0xED)
+                hi = 0x9F;
+        } else if (*c >= 0xF0 && *c <= 0xF4) {
+            n = 3;
+            if (*c == 0xF0)
+                lo = 0x90;
+            else if (*c == 0xF4)
+                hi = 0x8F;
+        } else {
+            break;
+        }
+        if ((size_t)(e - c) <= n || c[1] < lo || c[1] > hi)
+            break;
+        size_t i = 2;
+        while (i <= n && (c[i] & 0xC0) == 0x80)
+            i++;
+        if (i <= n)
+            break;
+        c += n + 1;
+    }
+    return (const char *)c;
+}
+
+// Under JSON_PARSE_VALIDATE_UTF8, fails a raw string body that is not valid
+// UTF-8, leaving p->cur at the bad byte.
+static int json__string_check(json_parser *p, const char *s, size_t l) {
+    if (!(p->flags & JSON_PARSE_VALIDATE_UTF8))
+        return 1;
+    const char *bad = json__utf8_scan(s, s + l);
+    if (bad == s + l)
+        return 1;
+    p->cur = bad;
+    p->error = JSON_ERROR_SYNTAX;
+    return 0;
+}
+
+static int json__hex4(const char *s, unsigned *out) {
+    unsigned x = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = s[i];
+        x <<= 4;
+        if (c >= '0' && c <= '9')
+            x |= (unsigned)(c - '0');
+        else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+            x |= (unsigned)((c | 0x20) - 'a' + 10);
+        else
+            return 0;
+    }
+    *out = x;
+    return 1;
+}
+
+static size_t json__utf8_encode(char *out, unsigned cp) {
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (char)(0xC0 | cp >> 6);
+        out[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (char)(0xE0 | cp >> 12);
+        out[1] = (char)(0x80 | (cp >> 6 & 0x3F));
+        out[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | cp >> 18);
+    out[1] = (char)(0x80 | (cp >> 12 & 0x3F));
+    out[2] = (char)(0x80 | (cp >> 6 & 0x3F));
+    out[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+// Decodes the escapes of the string body [s, s + l) into out, which needs
+// l bytes since no escape decodes to more than it takes to write. The runs
+// between backslashes are found by the string scanner and copied whole. A
+// surrogate pair becomes one code point and a lone surrogate U+FFFD, or an
+// error under JSON_PARSE_VALIDATE_UTF8. Returns the decoded length, or
+// SIZE_MAX with p->cur at the bad escape.
+static size_t json__unescape(json_parser *p, char *out, const char *s, size_t l) {
+    const char *end = s + l;
+    const char *e;
+    char *o = out;
+    while (1) {
+        e = json__scan_string(s, end);
+        memcpy(o, s, e - s);
+        o += e - s;
+        if (e == end)
+            break;
+        if (end - e < 2)
+            goto fail;
+        char c = e[1];
+        s = e + 2;
+        switch (c) {
+            case '"': *o++ = '"'; break;
+            case '\\': *o++ = '\\'; break;
+            case '/': *o++ = '/'; break;
+            case 'b': *o++ = '\b'; break;
+            case 'f': *o++ = '\f'; break;
+            case 'n': *o++ = '\n'; break;
+            case 'r': *o++ = '\r'; break;
+            case 't': *o++ = '\t'; break;
+            case 'u': {
+                unsigned cp, lo;
+                if (end - s < 4 || !json__hex4(s, &cp))
+                    goto fail;
+                s += 4;
+                if (cp >= 0xD800 && cp <= 0xDBFF && end - s >= 6 && s[0] == '\\' && s[1] == 'u' &&
+                    json__hex4(s + 2, &lo) && lo >= 0xDC00 && lo <= 0xDFFF) {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                    s += 6;
+                } else if (cp >= 0xD800 && cp <= 0xDFFF) {
+                    if (p->flags & JSON_PARSE_VALIDATE_UTF8)
+                        goto fail;
+                    cp = 0xFFFD;
+                }
+                o += json__utf8_encode(o, cp);
+                break;
+            }
+            default:
+                goto fail;
+        }
+    }
+    return (size_t)(o - out);
+
+fail:
+    p->cur = e;
+    p->error = JSON_ERROR_SYNTAX;
+    return SIZE_MAX;
+}
+
+// Gives the decoded bytes of a string body: s itself when it has no escapes,
+// otherwise a copy in small when it fits or on the heap, which the caller
+// releases with json__string_view_free. NULL with p->error set on failure.
+static const char *json__string_view(json_parser *p, const char *s, size_t *l, int escaped, char *small,
+                                     size_t small_size) {
+    if (!json__string_check(p, s, *l))
+        return NULL;
+    if (!escaped)
+        return s;
+    char *x = *l <= small_size ? small : json__heap_alloc(*l);
+    if (!x) {
+        p->error = JSON_ERROR_MEMORY;
+        return NULL;
+    }
+    size_t n = json__unescape(p, x, s, *l);
+    if (n == SIZE_MAX) {
+        if (x != small)
+            json__heap_free(x);
+        return NULL;
+    }
+    *l = n;
+    return x;
+}
+
+static void json__string_view_free(const char *view, const char *s, const char *small) {
+    if (view != s && view != small)
+        json__heap_free((char *)view);
+}
+
+// Strings without escapes, the common case, are a single copy or a view.
+static char *json__parse_string(json_parser *p, size_t *len, int *borrowed) {
+    p->cur++;
+    const char *s = p->cur;
+    int escaped;
+    if (!json__skip_string(p, &escaped))
+        return NULL;
+    const char *close = p->cur;
+    size_t l = *len = close - s;
+    if (!json__string_check(p, s, l))
+        return NULL;
+    *borrowed = (p->flags & JSON_PARSE_STRING_VIEWS) && !escaped;
+    if (*borrowed) {
+        p->cur++;
+        return (char *)s;
+    }
+    char* x = json__alloc(p->arena, l + 1);
+    if (!x) {
+        p->error = JSON_ERROR_MEMORY;
+        return NULL;
+    }
+    if (escaped) {
+        l = *len = json__unescape(p, x, s, l);
+        if (l == SIZE_MAX) {
+            json__free(p->arena, x);
+            return NULL;
+        }
+    } else {
+        memcpy(x, s, l);
+    }
+    x[l] = '\0';
+    p->cur = close + 1;
+    return x;
+}
+
+// Interned keys are borrowed from the table, so a repeated key costs a
+// lookup instead of an allocation.
+static char *json__parse_key(json_parser *p, size_t *len, int *borrowed) {
+    if (!p->intern)
+        return json__parse_string(p, len, borrowed);
+
+    const char *start = p->cur;
+    const char *s = ++p->cur;
+    int escaped;
+    if (!json__skip_string(p, &escaped))
+        return NULL;
+    const char *k;
+    if (!escaped) {
+        *len = p->cur - s;
+        if (!json__string_check(p, s, *len))
+            return NULL;
+        p->cur++;
+        k = json_intern(p->intern, s, *len);
+    } else {
+        json_parser q = *p;
+        q.cur = start;
+        q.arena = NULL;
+        q.flags &= ~JSON_PARSE_STRING_VIEWS;
+        int copied;
+        char *x = json__parse_string(&q, len, &copied);
+        p->cur = q.cur;
+        if (!x) {
+            p->error = q.error;
+            return NULL;
+        }
+        k = json_intern(p->intern, x, *len);
+        json__heap_free(x);
+    }
+    if (!k) {
+        p->error = JSON_ERROR_MEMORY;
+        return NULL;
+    }
+    *borrowed = 1;
+    return (char *)k;
+}
+
+static const double json__pow10_exact[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+    1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Integers that fit in 64 bits are kept exact. Other numbers take Clinger's
+// fast path when the decimal significand and exponent are both exactly
+// representable as doubles, and otherwise fall back to strtod with the
+// decimal point translated to the current locale.
+static int json__parse_number(json_parser *p, double *number, int64_t *integer, int *is_integer) {
+    const char *s = p->cur;
+    int negative = 0;
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    int fraction = 0;
+
+    if (p->cur < p->end && *p->cur == '-') {
+        negative = 1;
+        p->cur++;
+    }
+    const char *int_start = p->cur;
+    for (; p->cur < p->end && isdigit((unsigned char)*p->cur); p->cur++) {
+        if (digits < 19)
+            mantissa = mantissa * 10 + (uint64_t)(*p->cur - '0');
+        else
+            exponent++;
+        if (mantissa)
+            digits++;
+    }
+    if (p->cur == int_start)
+        goto fail;
+    if (*int_start == '0' && p->cur - int_start > 1) {
+        p->cur = int_start + 1;
+        goto fail;
+    }
+    if (p->cur < p->end && *p->cur == '.') {
+        fraction = 1;
+        p->cur++;
+        const char *frac_start = p->cur;
+        for (; p->cur < p->end && isdigit((unsigned char)*p->cur); p->cur++) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (uint64_t)(*p->cur - '0');
+                exponent--;
+                if (mantissa)
+                    digits++;
+            }
+        }
+        if (p->cur == frac_start)
+            goto fail;
+    }
+    if (p->cur < p->end && (*p->cur == 'e' || *p->cur == 'E')) {
+        fraction = 1;
+        p->cur++;
+        int exp_negative = 0;
+        if (p->cur < p->end && (*p->cur == '+' || *p->cur == '-'))
+            exp_negative = *p->cur++ == '-';
+        const char *exp_start = p->cur;
+        int e = 0;
+        for (; p->cur < p->end && isdigit((unsigned char)*p->cur); p->cur++)
+            if (e < 100000)
+                e = e * 10 + (*p->cur - '0');
+        if (p->cur == exp_start)
+            goto fail;
+        exponent += exp_negative ? -e : e;
+    }
+
+    *is_integer = 0;
+    if (!fraction && exponent == 0 && !(negative && mantissa == 0)) {
+        if (!negative && mantissa <= (uint64_t)INT64_MAX) {
+            *is_integer = 1;
+            *integer = (int64_t)mantissa;
+        } else if (negative && mantissa <= (uint64_t)INT64_MAX + 1) {
+            *is_integer = 1;
+            *integer = (int64_t)(0 - mantissa);
+        }
+        if (*is_integer) {
+            *number = (double)*integer;
+            return 1;
+        }
+    }
+
+    if (digits <= 19 && mantissa <= (1ull << 53) && exponent >= -22 && exponent <= 22) {
+        double d = (double)mantissa;
+        d = exponent < 0 ? d / json__pow10_exact[-exponent] : d * json__pow10_exact[exponent];
+        *number = negative ? -d : d;
+        return 1;
+    }
+
+    // strtod needs a terminator, which the input buffer is not guaranteed to
+    // have, so the validated span is copied out first.
+    size_t l = p->cur - s;
+    char small[64];
+    char *tmp = l < sizeof small ? small : json__heap_alloc(l + 1);
+    if (!tmp)
+        goto fail;
+    memcpy(tmp, s, l);
+    tmp[l] = '\0';
+    char *dot = memchr(tmp, '.', l);
+    if (dot)
+        *dot = *localeconv()->decimal_point;
+    *number = strtod(tmp, NULL);
+    if (tmp != small)
+        json__heap_free(tmp);
+    return 1;
+
+fail:
+    p->error = JSON_ERROR_SYNTAX;
+    return 0;
+}
+
+// Saturating, since converting an out-of-range double is undefined.
+static int64_t json__double_to_integer(double d) {
+    if (d != d)
+        return 0;
+    if (d >= 9223372036854775807.0)
+        return INT64_MAX;
+    if (d <= -9223372036854775808.0)
+        return INT64_MIN;
+    return (int64_t)d;
+}
+
+static int json__match_literal(json_parser *p, const char *literal, size_t l) {
+    if ((size_t)(p->end - p->cur) < l || memcmp(p->cur, literal, l) != 0)
+        return 0;
+    p->cur += l;
+    return 1;
+}
+
+typedef enum {
+    JSON__EXPECT_VALUE,
+    JSON__EXPECT_VALUE_OR_CLOSE,
+    JSON__EXPECT_KEY,
+    JSON__EXPECT_KEY_OR_CLOSE,
+    JSON__EXPECT_COLON,
+    JSON__EXPECT_NEXT,
+    JSON__EXPECT_DONE
+} json__expect;
+
+// Checks the grammar of the number at p->cur and advances past it.
+static int json__skip_number(json_parser *p) {
+    if (p->cur < p->end && *p->cur == '-')
+        p->cur++;
+    const char *s = p->cur;
+    while (p->cur < p->end && isdigit((unsigned char)*p->cur))
+        p->cur++;
+    if (p->cur == s)
+        goto fail;
+    if (*s == '0' && p->cur - s > 1) {
+        p->cur = s + 1;
+        goto fail;
+    }
+    if (p->cur < p->end && *p->cur == '.') {
+        s = ++p->cur;
+        while (p->cur < p->end && isdigit((unsigned char)*p->cur))
+            p->cur++;
+        if (p->cur == s)
+            goto fail;
+    }
+    if (p->cur < p->end && (*p->cur == 'e' || *p->cur == 'E')) {
+        p->cur++;
+        if (p->cur < p->end && (*p->cur == '+' || *p->cur == '-'))
+            p->cur++;
+        s = p->cur;
+        while (p->cur < p->end && isdigit((unsigned char)*p->cur))
+            p->cur++;
+        if (p->cur == s)
+            goto fail;
+    }
+    return 1;
+
+fail:
+    p->error = JSON_ERROR_SYNTAX;
+    return 0;
+}
+
+// Advances past the object or array opening at p->cur, checking its grammar
+// as the parsers do but building nothing, with at most max_depth levels of
+// nesting counting its own. Escapes and string encoding are only checked
+// once the container is materialized.
+static int json__skip_container(json_parser *p, size_t max_depth) {
+    char small[32];
+    char *stack = small;
+    size_t cap = sizeof small;
+    size_t depth = 0;
+    json__expect expect = JSON__EXPECT_VALUE;
+    int escaped;
+    int ok = 0;
+    while (1) {
+        json__skip_whitespace(p);
+        if (p->cur >= p->end)
+            goto fail;
+        char c = *p->cur;
+        switch (c) {
+            case '{':
+            case '[':
+                if (expect != JSON__EXPECT_VALUE && expect != JSON__EXPECT_VALUE_OR_CLOSE)
+                    goto fail;
+                if (depth == max_depth) {
+                    p->error = JSON_ERROR_DEPTH;
+                    goto done;
+                }
+                if (depth == cap) {
+                    char *temp = json__heap_realloc(stack == small ? NULL : stack, cap * 2);
+                    if (!temp) {
+                        p->error = JSON_ERROR_MEMORY;
+                        goto done;
+                    }
+                    if (stack == small)
+                        memcpy(temp, small, sizeof small);
+                    stack = temp;
+                    cap *= 2;
+                }
+                stack[depth++] = c;
+                expect = c == '{' ? JSON__EXPECT_KEY_OR_CLOSE : JSON__EXPECT_VALUE_OR_CLOSE;
+                p->cur++;
+                break;
+            case '}':
+            case ']': {
+                int empty = expect == (c == '}' ? JSON__EXPECT_KEY_OR_CLOSE : JSON__EXPECT_VALUE_OR_CLOSE);
+                if (stack[depth - 1] != (c == '}' ? '{' : '[') || (!empty && expect != JSON__EXPECT_NEXT))
+                    goto fail;
+                p->cur++;
+                if (--depth == 0) {
+                    ok = 1;
+                    goto done;
+                }
+                expect = JSON__EXPECT_NEXT;
+                break;
+            }
+            case ':':
+                if (expect != JSON__EXPECT_COLON)
+                    goto fail;
+                expect = JSON__EXPECT_VALUE;
+                p->cur++;
+                break;
+            case ',':
+                if (expect != JSON__EXPECT_NEXT)
+                    goto fail;
+                expect = stack[depth - 1] == '{' ? JSON__EXPECT_KEY : JSON__EXPECT_VALUE;
+                p->cur++;
+                break;
+            case '"':
+                if (expect == JSON__EXPECT_KEY || expect == JSON__EXPECT_KEY_OR_CLOSE)
+                    expect = JSON__EXPECT_COLON;
+                else if (expect == JSON__EXPECT_VALUE || expect == JSON__EXPECT_VALUE_OR_CLOSE)
+                    expect = JSON__EXPECT_NEXT;
+                else
+                    goto fail;
+                p->cur++;
+                if (!json__skip_string(p, &escaped))
+                    goto done;
+                p->cur++;
+                break;
+            default:
+                if (expect != JSON__EXPECT_VALUE && expect != JSON__EXPECT_VALUE_OR_CLOSE)
+                    goto fail;
+                if (c == '-' || isdigit((unsigned char)c)) {
+                    if (!json__skip_number(p))
+                        goto done;
+                } else if (!json__match_literal(p, "true", 4) && !json__match_literal(p, "false", 5) &&
+                           !json__match_literal(p, "null", 4)) {
+                    goto fail;
+                }
+                expect = JSON__EXPECT_NEXT;
+                break;
+        }
+    }
+
+fail:
+    p->error = JSON_ERROR_SYNTAX;
+done:
+    if (stack != small)
+        json__heap_free(stack);
+    return ok;
+}
+
+static json_value *json__parse_lazy(json_parser *p, size_t max_depth) {
+    const char *s = p->cur;
+    if (!json__skip_container(p, max_depth))
+        return NULL;
+    json_value *v = json__alloc(p->arena, sizeof *v);
+    if (!v) {
+        p->error = JSON_ERROR_MEMORY;
+        return NULL;
+    }
+    v->type = *s == '{' ? JSON_OBJECT : JSON_ARRAY;
+    v->flags = JSON__FLAG_ARENA | JSON__FLAG_LAZY;
+    if (p->flags & JSON_PARSE_STRING_VIEWS)
+        v->flags |= JSON__FLAG_LAZY_VIEWS;
+    if (p->flags & JSON_PARSE_VALIDATE_UTF8)
+        v->flags |= JSON__FLAG_LAZY_UTF8;
+    v->lazy.data = s;
+    v->lazy.len = p->cur - s;
+    v->lazy.arena = p->arena;
+    return v;
+}
+
+static json_value *json__parse_scalar(json_parser *p) {
+    json_value *v;
+    if (*p->cur == '"') {
+        size_t l;
+        int borrowed;
+        char *s = json__parse_string(p, &l, &borrowed);
+        if (!s)
+            return NULL;
+        v = json__new_value(p->arena, JSON_STRING);
+        if (!v) {
+            if (!borrowed)
+                json__free(p->arena, s);
+            goto oom;
+        }
+        if (borrowed)
+            v->flags |= JSON__FLAG_BORROWED;
+        v->string.data = s;
+        v->string.len = l;
+        return v;
+    }
+    if(json__match_literal(p, "true", 4)) {
+        if (p->arena)
+            return &json__true;
+        if (!(v = json__new_value(p->arena, JSON_BOOL)))
+            goto oom;
+        v->boolean = 1;
+        return v;
+    }
+    if(json__match_literal(p, "false", 5)) {
+        if (p->arena)
+            return &json__false;
+        if (!(v = json__new_value(p->arena, JSON_BOOL)))
+            goto oom;
+        v->boolean = 0;
+        return v;
+    }
+    if (json__match_literal(p, "null", 4)) {
+        if (p->arena)
+            return &json__null;
+        if (!(v = json__new_value(p->arena, JSON_NULL)))
+            goto oom;
+        return v;
+    }
+    if(*p->cur == '-' || isdigit((unsigned char)*p->cur)) {
+        double n;
+        int64_t i;
+        int is_integer;
+        if (!json__parse_number(p, &n, &i, &is_integer))
+            return NULL;
+        if (!(v = json__new_value(p->arena, JSON_NUMBER)))
+            goto oom;
+        if (is_integer) {
+            v->flags |= JSON__FLAG_INTEGER;
+            v->integer = i;
+        } else {
+            v->number = n;
+        }
+        return v;
+    }
+    p->error = JSON_ERROR_SYNTAX;
+    return NULL;
+
+oom:
+    p->error = JSON_ERROR_MEMORY;
+    return NULL;
+}
+
+static size_t json__max_depth(json_parser *p) {
+    return p->max_depth ? p->max_depth : JSON_DEFAULT_MAX_DEPTH;
+}
+
+typedef struct {
+    json_value *container;
+    char *key;
+    size_t key_len;
+    int key_borrowed;
+} json__parse_frame;
+
+// Reads the key and colon that start every object member into the frame.
+static int json__parse_member_key(json_parser *p, json__parse_frame *f) {
+    json__skip_whitespace(p);
+    if (p->cur >= p->end || *p->cur != '"')
+        return 0;
+    f->key = json__parse_key(p, &f->key_len, &f->key_borrowed);
+    if (!f->key)
+        return 0;
+    if (f->key_len > INT32_MAX) {
+        p->error = JSON_ERROR_TOO_LARGE;
+        return 0;
+    }
+    json__skip_whitespace(p);
+    if (p->cur >= p->end || *p->cur != ':')
+        return 0;
+    p->cur++;
+    return 1;
+}
+
+// The tree parser keeps its open containers on an explicit stack, so
+// nesting costs heap rather than C stack and is bounded by max_depth.
+// Every value is attached to its parent as soon as it is created, which
+// leaves exactly one tree to free on failure. With eager_root set the
+// outermost container is parsed even in lazy mode, which is how a lazy
+// node is materialized.
+static json_value *json__parse_tree(json_parser *p, int eager_root) {
+    json__parse_frame small[32];
+    json__parse_frame *stack = small;
+    size_t depth = 0;
+    size_t cap = sizeof small / sizeof *small;
+    size_t max_depth = json__max_depth(p);
+    json_value *root = NULL;
+    json_value *v = NULL;
+
+    while (1) {
+        json__skip_whitespace(p);
+        if (p->cur >= p->end)
+            goto fail;
+
+        char c = *p->cur;
+        int open = 0;
+        if ((c == '{' || c == '[') && (p->flags & JSON_PARSE_LAZY) && p->arena && (depth || !eager_root)) {
+            v = json__parse_lazy(p, max_depth - depth);
+        } else if (c == '{' || c == '[') {
+            v = json__new_value(p->arena, c == '{' ? JSON_OBJECT : JSON_ARRAY);
+            if (!v) {
+                p->error = JSON_ERROR_MEMORY;
+                goto fail;
+            }
+            p->cur++;
+            open = 1;
+        } else {
+            v = json__parse_scalar(p);
+        }
+        if (!v)
+            goto fail;
+
+        if (!depth) {
+            root = v;
+        } else {
+            json__parse_frame *f = &stack[depth - 1];
+            int ok;
+            if (f->container->type == JSON_ARRAY) {
+                ok = json__array_push(p->arena, &f->container->array, v);
+            } else {
+                ok = json__object_push(p->arena, &f->container->object,
+                                       (kvp){f->key, v, (uint32_t)f->key_len, (uint32_t)f->key_borrowed, 0});
+                if (ok)
+                    f->key = NULL;
+            }
+            if (!ok) {
+                p->error = JSON_ERROR_MEMORY;
+                goto fail;
+            }
+        }
+        json_value *opened = open ? v : NULL;
+        v = NULL;
+
+        if (opened) {
+            if (depth == max_depth) {
+                p->error = JSON_ERROR_DEPTH;
+                goto fail;
+            }
+            if (depth == cap) {
+                json__parse_frame *temp = stack == small ? json__heap_alloc(2 * cap * sizeof *temp)
+                                                         : json__heap_realloc(stack, 2 * cap * sizeof *temp);
+                if (!temp) {
+                    p->error = JSON_ERROR_MEMORY;
+                    goto fail;
+                }
+                if (stack == small)
+                    memcpy(temp, small, sizeof small);
+                stack = temp;
+                cap *= 2;
+            }
+            stack[depth++] = (json__parse_frame){opened, NULL, 0, 0};
+            json__skip_whitespace(p);
+            if (p->cur < p->end && *p->cur == (opened->type == JSON_OBJECT ? '}' : ']')) {
+                p->cur++;
+                depth--;
+            } else {
+                if (opened->type == JSON_OBJECT && !json__parse_member_key(p, &stack[depth - 1]))
+                    goto fail;
+                continue;
+            }
+        }
+
+        // The value is complete: move on to the next member or element,
+        // closing every container that ends here.
+        while (depth) {
+            json__parse_frame *f = &stack[depth - 1];
+            json__skip_whitespace(p);
+            if (p->cur >= p->end)
+                goto fail;
+            if (*p->cur == ',') {
+                p->cur++;
+                if (f->container->type == JSON_OBJECT && !json__parse_member_key(p, f))
+                    goto fail;
+                break;
+            }
+            if (*p->cur != (f->container->type == JSON_OBJECT ? '}' : ']'))
+                goto fail;
+            p->cur++;
+            if (f->container->type == JSON_OBJECT && f->container->object.count >= JSON_OBJECT_INDEX_THRESHOLD)
+                json__object_build_index(p->arena, &f->container->object);
+            depth--;
+        }
+        if (!depth)
+            break;
+    }
+    if (stack != small)
+        json__heap_free(stack);
+    return root;
+
+fail:
+    if (p->error == JSON_ERROR_NONE)
+        p->error = JSON_ERROR_SYNTAX;
+    if (depth && stack[depth - 1].key && !stack[depth - 1].key_borrowed)
+        json__free(p->arena, stack[depth - 1].key);
+    json_free(&v);
+    json_free(&root);
+    if (stack != small)
+        json__heap_free(stack);
+    return NULL;
+}
+
+json_value *json__parse_value(json_parser *p) {
+    return json__parse_tree(p, 0);
+}
+
+static void json__parse_clear_position(json_parser *p) {
+    p->error_offset = p->error_line = p->error_column = 0;
+}
+
+// Fills in where a parse of data stopped once it has failed. Counting lines
+// only here keeps the position free while the input is valid.
+static void json__parse_position(json_parser *p, const char *data) {
+    json__parse_clear_position(p);
+    if (p->error == JSON_ERROR_NONE)
+        return;
+    const char *at = p->cur;
+    if (!at || at < data)
+        at = data;
+    if (at > p->end)
+        at = p->end;
+    const char *line = data;
+    const char *nl;
+    p->error_line = 1;
+    while ((nl = memchr(line, '\n', at - line))) {
+        p->error_line++;
+        line = nl + 1;
+    }
+    p->error_offset = at - data;
+    p->error_column = at - line + 1;
+}
+
+// Parses a lazy container one level deep in place, its own containers
+// becoming lazy in turn.
+static int json__materialize(json_value *v) {
+    if (!(v->flags & JSON__FLAG_LAZY))
+        return 1;
+
+    json_parser p = {0};
+    p.cur = v->lazy.data;
+    p.end = v->lazy.data + v->lazy.len;
+    p.arena = v->lazy.arena;
+    p.flags = JSON_PARSE_LAZY | (v->flags & JSON__FLAG_LAZY_VIEWS ? JSON_PARSE_STRING_VIEWS : 0) |
+              (v->flags & JSON__FLAG_LAZY_UTF8 ? JSON_PARSE_VALIDATE_UTF8 : 0);
+    json_value *x = json__parse_tree(&p, 1);
+    if (!x) {
+        if (v->lazy.arena->error == JSON_ERROR_NONE)
+            v->lazy.arena->error = p.error != JSON_ERROR_NONE ? p.error : JSON_ERROR_SYNTAX;
+        v->flags &= ~(JSON__FLAG_LAZY | JSON__FLAG_LAZY_VIEWS | JSON__FLAG_LAZY_UTF8);
+        if (v->type == JSON_OBJECT)
+            v->object = (struct json_object){NULL, {NULL}, 0, 0};
+        else
+            v->array = (struct json_array){NULL, 0, 0, {NULL}};
+        return 0;
+    }
+    *v = *x;
+    if (v->type == JSON_ARRAY && x->array.items == x->array.small)
+        v->array.items = v->array.small;
+    return 1;
+}
+
+static char *json__read_entire_file(const char* path, size_t *len) {
+    char *data = NULL;
+
+    FILE *fin = fopen(path, "rb");
+    if (fin == NULL) {
+        fprintf(stderr, "error, failed to open %s: %s:%d\n", path, __FILE__, __LINE__);
+        return NULL;
+    }
+
+    char *temp = NULL;
+    size_t n = 0;
+    size_t size = 0;
+    size_t used = 0;
+    while (1) {
+        if (used + JSON_READ_ENTIRE_FILE_CHUNK + 1 > size) {
+            size = used + JSON_READ_ENTIRE_FILE_CHUNK + 1;
+
+            if (size <= used) {
+                if (data != NULL)
+                    json__heap_free(data);
+                fclose(fin);
+                fprintf(stderr, "error, failed reading %s into memory becase the file size overflowed the size_t type\n", path);
+                return NULL;
+            }
+
+            temp = json__heap_realloc(data, size);
+            if (temp == NULL) {
+                if (data != NULL)
+                    json__heap_free(data);
+                fclose(fin);
+                fprintf(stderr, "error, failed to reallocate data (size %zu bytes) to %zu byte container\n", sizeof *data, size);
+                return NULL;
+            }
+            data = temp;
+        }
+
+        n = fread(data + used, 1, JSON_READ_ENTIRE_FILE_CHUNK, fin);
+        if (ferror(fin)) {
+            if (data != NULL)
+                json__heap_free(data);
+            fclose(fin);
+            fprintf(stderr, "error, failed to read chunk of %s into data\n", path);
+            return NULL;
+        }
+
+        used += n;
+
+        if (feof(fin))
+            break;
+    }
+    fclose(fin);
+
+    temp = json__heap_realloc(data, used+1);
+    if (temp == NULL) {
+        if (data != NULL)
+            json__heap_free(data);
+        fprintf(stderr, "error, failed to reallocate data (size %zu bytes) to %zu byte container\n", sizeof *data, size);
+        return NULL;
+    }
+    data = temp;
+    data[used] = '\0';
+    *len = used;
+    return data;
+}
+
+char *json_read_entire_file_to_cstr(const char* path) {
+    size_t len;
+    return json__read_entire_file(path, &len);
+}
+
+static int json__file_open(json__file *f, const char *path) {
+    f->data = NULL;
+    f->size = 0;
+    f->mapped = 0;
+#ifdef JSON__HAVE_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "error, failed to open %s: %s:%d\n", path, __FILE__, __LINE__);
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+            madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+            close(fd);
+            f->data = data;
+            f->size = (size_t)st.st_size;
+            f->mapped = 1;
+            return 1;
+        }
+    }
+    close(fd);
+#endif
+    // Empty files, pipes and platforms without mmap are read onto the heap.
+    char *data = json__read_entire_file(path, &f->size);
+    if (!data)
+        return 0;
+    f->data = data;
+    return 1;
+}
+
+static void json__file_close(json__file *f) {
+#ifdef JSON__HAVE_MMAP
+    if (f->mapped)
+        munmap((void *)f->data, f->size);
+    else
+#endif
+        json__heap_free((void *)f->data);
+    f->data = NULL;
+    f->size = 0;
+    f->mapped = 0;
+}
+
+// Runs fn for every task in [0, tasks) on up to workers threads, the caller
+// being worker 0. Tasks are handed out in order as workers free up.
+typedef void (*json__task_fn)(void *ctx, size_t worker, size_t task);
+
+typedef struct {
+    json__task_fn fn;
+    void *ctx;
+    size_t tasks;
+    size_t next;
+#ifdef JSON__HAVE_THREADS
+    pthread_mutex_t lock;
+#endif
+} json__pool;
+
+typedef struct {
+    json__pool *pool;
+    size_t worker;
+} json__pool_worker;
+
+static void *json__pool_run(void *arg) {
+    json__pool_worker *w = arg;
+    json__pool *pool = w->pool;
+    while (1) {
+#ifdef JSON__HAVE_THREADS
+        pthread_mutex_lock(&pool->lock);
+#endif
+        size_t task = pool->next++;
+#ifdef JSON__HAVE_THREADS
+        pthread_mutex_unlock(&pool->lock);
+#endif
+        if (task >= pool->tasks)
+            return NULL;
+        pool->fn(pool->ctx, w->worker, task);
+    }
+}
+
+static size_t json__default_workers(void) {
+#if defined(JSON__HAVE_THREADS) && defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (size_t)n : 1;
+#else
+    return 1;
+#endif
+}
+
+// Returns the number of workers actually used, which may be fewer than
+// asked for if threads cannot be created.
+static size_t json__parallel_run(size_t tasks, size_t workers, json__task_fn fn, void *ctx) {
+    json__pool pool;
+    pool.fn = fn;
+    pool.ctx = ctx;
+    pool.tasks = tasks;
+    pool.next = 0;
+    if (workers > tasks)
+        workers = tasks ? tasks : 1;
+#ifdef JSON__HAVE_THREADS
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_t *threads = workers > 1 ? json__heap_alloc((workers - 1) * sizeof *threads) : NULL;
+    json__pool_worker *args = json__heap_alloc(workers * sizeof *args);
+    size_t started = 0;
+    if (args) {
+        for (size_t i = 0; i < workers; i++)
+            args[i] = (json__pool_worker){&pool, i};
+        if (threads)
+            while (started + 1 < workers && pthread_create(&threads[started], NULL, json__pool_run, &args[started + 1]) == 0)
+                started++;
+        json__pool_run(&args[0]);
+        for (size_t i = 0; i < started; i++)
+            pthread_join(threads[i], NULL);
+    } else {
+        json__pool_worker w = {&pool, 0};
+        json__pool_run(&w);
+    }
+    json__heap_free(threads);
+    json__heap_free(args);
+    pthread_mutex_destroy(&pool.lock);
+    return started + 1;
+#else
+    (void)workers;
+    json__pool_worker w = {&pool, 0};
+    json__pool_run(&w);
+    return 1;
+#endif
+}
+
+static void json__arena_adopt(json_arena *a, json_arena *from) {
+    struct json_arena_chunk *c = from->head;
+    if (!c)
+        return;
+    // Spliced in behind the current chunk so allocation carries on there.
+    while (c->next)
+        c = c->next;
+    if (a->head) {
+        c->next = a->head->next;
+        a->head->next = from->head;
+    } else {
+        a->head = from->head;
+    }
+    from->head = NULL;
+}
+
+typedef struct {
+    const char *begin;
+    const char *end;
+    size_t first;
+    size_t count;
+    const char *error_at;
+    json_error error;
+} json__array_range;
+
+typedef struct {
+    json__array_range *ranges;
+    json_arena *arenas;
+    json_value **items;
+    unsigned flags;
+    size_t max_depth;
+} json__array_job;
+
+// Finds the top-level commas of the array opening at p->cur, counting its
+// elements and cutting them into ranges of roughly the same byte size.
+// Nothing but brackets and strings is checked, the parse that follows
+// validates the rest.
+static json__array_range *json__array_split(json_parser *p, size_t *ranges, size_t *count) {
+    const char *base = p->cur;
+    size_t n = *ranges;
+    size_t step = (size_t)(p->end - base) / n + 1;
+    json__array_range *r = json__heap_calloc(n, sizeof *r);
+    if (!r) {
+        p->error = JSON_ERROR_MEMORY;
+        return NULL;
+    }
+    size_t used = 0;
+    size_t elements = 0;
+    size_t depth = 0;
+    int escaped;
+    p->cur++;
+    r[0].begin = p->cur;
+    json__skip_whitespace(p);
+    const char *first = p->cur;
+    while (1) {
+        json__skip_whitespace(p);
+        if (p->cur >= p->end)
+            goto fail;
+        char c = *p->cur;
+        if (c == '"') {
+            p->cur++;
+            if (!json__skip_string(p, &escaped))
+                goto fail;
+        } else if (c == '{' || c == '[') {
+            depth++;
+        } else if (c == '}' || c == ']') {
+            if (depth == 0) {
+                if (c != ']')
+                    goto fail;
+                if (p->cur != first)
+                    elements++;
+                break;
+            }
+            depth--;
+        } else if (c == ',' && depth == 0) {
+            elements++;
+            if ((size_t)(p->cur - base) >= step * (used + 1) && used + 1 < n) {
+                r[used].end = p->cur;
+                r[used].count = elements - r[used].first;
+                used++;
+                r[used].begin = p->cur + 1;
+                r[used].first = elements;
+            }
+        }
+        p->cur++;
+    }
+    r[used].end = p->cur;
+    r[used].count = elements - r[used].first;
+    *ranges = used + 1;
+    *count = elements;
+    return r;
+
+fail:
+    json__heap_free(r);
+    p->error = JSON_ERROR_SYNTAX;
+    return NULL;
+}
+
+static void json__array_parse_range(void *ctx, size_t worker, size_t task) {
+    json__array_job *job = ctx;
+    json__array_range *r = &job->ranges[task];
+    json_parser p = {0};
+    p.cur = r->begin;
+    p.end = r->end;
+    p.arena = job->arenas ? &job->arenas[worker] : NULL;
+    p.flags = job->flags;
+    p.max_depth = job->max_depth;
+    size_t i = 0;
+    while (i < r->count) {
+        json_value *e = json__parse_value(&p);
+        if (!e)
+            goto fail;
+        job->items[r->first + i++] = e;
+        json__skip_whitespace(&p);
+        if (i == r->count)
+            break;
+        if (p.cur >= p.end || *p.cur != ',')
+            goto fail;
+        p.cur++;
+    }
+    if (p.cur == p.end)
+        return;
+
+fail:
+    while (i > 0) {
+        i--;
+        json_free(&job->items[r->first + i]);
+    }
+    r->error_at = p.cur;
+    r->error = p.error != JSON_ERROR_NONE ? p.error : JSON_ERROR_SYNTAX;
+}
+
+// The parallel path for a top-level array: one pre-scan sizes the items
+// buffer exactly and cuts the elements into ranges that the pool parses into
+// their final slots, each worker allocating from its own arena.
+static json_value *json__parse_array_parallel(json_parser *p, size_t threads) {
+    size_t ranges = threads * 4;
+    size_t count;
+    json__array_range *r = json__array_split(p, &ranges, &count);
+    if (!r)
+        return NULL;
+    if (count > UINT32_MAX) {
+        json__heap_free(r);
+        p->error = JSON_ERROR_TOO_LARGE;
+        return NULL;
+    }
+
+    json_value *x = json__new_value(p->arena, JSON_ARRAY);
+    if (!x) {
+        json__heap_free(r);
+        p->error = JSON_ERROR_MEMORY;
+        return NULL;
+    }
+    if (!count) {
+        p->cur = r[0].end + 1;
+        json__heap_free(r);
+        return x;
+    }
+    json_value **items = json__alloc(p->arena, count * sizeof *items);
+    json_arena *arenas = p->arena ? json__heap_calloc(threads, sizeof *arenas) : NULL;
+    for (size_t i = 0; arenas && i < threads; i++)
+        arenas[i].allocator = p->arena->allocator;
+    if (!items || (p->arena && !arenas)) {
+        if (items)
+            json__free(p->arena, items);
+        json_free(&x);
+        json__heap_free(arenas);
+        json__heap_free(r);
+        p->error = JSON_ERROR_MEMORY;
+        return NULL;
+    }
+    x->array.items = items;
+    x->array.cap = (uint32_t)count;
+
+    // Elements sit one level below the array.
+    json__array_job job = {r, arenas, items, p->flags, json__max_depth(p) - 1};
+    json__parallel_run(ranges, threads, json__array_parse_range, &job);
+
+    const char *close = r[ranges - 1].end;
+    p->error = JSON_ERROR_NONE;
+    for (size_t i = 0; i < ranges; i++) {
+        if (r[i].error == JSON_ERROR_NONE)
+            continue;
+        if (p->error == JSON_ERROR_NONE) {
+            p->error = r[i].error;
+            p->cur = r[i].error_at;
+        }
+    }
+    if (arenas) {
+        for (size_t i = 0; i < threads; i++)
+            json__arena_adopt(p->arena, &arenas[i]);
+        json__heap_free(arenas);
+    }
+    if (p->error != JSON_ERROR_NONE) {
+        for (size_t i = 0; i < ranges; i++)
+            if (r[i].error == JSON_ERROR_NONE)
+                for (size_t k = 0; k < r[i].count; k++)
+                    json_free(&items[r[i].first + k]);
+        json__heap_free(r);
+        json_free(&x);
+        return NULL;
+    }
+    json__heap_free(r);
+    x->array.count = (uint32_t)count;
+    p->cur = close + 1;
+    return x;
+}
+
+json_value *json_from_buffer_ex(json_parser *p, const char *data, size_t len) {
+    JSON__STATS_CLOCK(t);
+    p->cur = data;
+    p->end = data + len;
+    p->error = JSON_ERROR_NONE;
+    json_value *v = NULL;
+    size_t threads = 0;
+    if (p->flags & JSON_PARSE_PARALLEL) {
+        json__skip_whitespace(p);
+        threads = p->threads ? p->threads : json__default_workers();
+        if (p->cur >= p->end || *p->cur != '[' || len < JSON_PARALLEL_MIN_SIZE || (p->flags & JSON_PARSE_LAZY) ||
+            json__max_depth(p) < 2)
+            threads = 0;
+    }
+    v = threads > 1 ? json__parse_array_parallel(p, threads) : json__parse_value(p);
+    if (v) {
+        json__skip_whitespace(p);
+        if (p->cur < p->end) {
+            json_free(&v);
+            p->error = JSON_ERROR_SYNTAX;
+        }
+    }
+    json__parse_position(p, data);
+    JSON__STATS_ADD(parses, 1);
+    JSON__STATS_ADD(bytes_parsed, len);
+    JSON__STATS_ELAPSED(parse_ns, t);
+    return v;
+}
+
+json_value *json_from_string_ex(json_parser *p, const char *string) {
+    return json_from_buffer_ex(p, string, strlen(string));
+}
+
+json_value *json_from_file_ex(json_parser *p, const char *path) {
+    json__file f;
+    if (!json__file_open(&f, path)) {
+        p->cur = p->end = NULL;
+        p->error = JSON_ERROR_IO;
+        json__parse_clear_position(p);
+        return NULL;
+    }
+    unsigned flags = p->flags;
+    p->flags &= ~JSON_PARSE_STRING_VIEWS;
+    json_value *value = json_from_buffer_ex(p, f.data, f.size);
+    p->flags = flags;
+    json__file_close(&f);
+    p->cur = p->end = NULL;
+    return value;
+}
+
+json_value *json_from_buffer(const char *data, size_t len) {
+    json_parser p = {0};
+    return json_from_buffer_ex(&p, data, len);
+}
+
+json_value *json_from_string(const char *string) {
+    json_parser p = {0};
+    return json_from_string_ex(&p, string);
+}
+
+json_value *json_from_file(const char *path) {
+    json_parser p = {0};
+    return json_from_file_ex(&p, path);
+}
+
+static json_document *json__document_new(const json_allocator *allocator) {
+    json_arena a = {NULL, allocator, JSON_ERROR_NONE};
+    json_document *doc = json__chunk_alloc(&a, sizeof *doc);
+    if (!doc)
+        return NULL;
+    doc->arena = a;
+    doc->intern = NULL;
+    doc->root = NULL;
+    doc->source = NULL;
+    doc->source_size = 0;
+    doc->source_mapped = 0;
+    return doc;
+}
+
+json_document *json_document_from_buffer_ex(json_parser *p, const char *data, size_t len) {
+    json_document *doc = json__document_new(p->allocator);
+    if (!doc) {
+        p->error = JSON_ERROR_MEMORY;
+        json__parse_clear_position(p);
+        return NULL;
+    }
+    p->arena = &doc->arena;
+    if ((p->flags & JSON_PARSE_INTERN_KEYS) && !p->intern) {
+        doc->intern = json_intern_table_new();
+        p->intern = doc->intern;
+    }
+    doc->root = json_from_buffer_ex(p, data, len);
+    p->arena = NULL;
+    if (p->intern == doc->intern)
+        p->intern = NULL;
+    if (!doc->root)
+        json_document_free(&doc);
+    return doc;
+}
+
+json_document *json_document_from_string_ex(json_parser *p, const char *string) {
+    return json_document_from_buffer_ex(p, string, strlen(string));
+}
+
+json_document *json_document_from_file_ex(json_parser *p, const char *path) {
+    json__file f;
+    if (!json__file_open(&f, path)) {
+        p->cur = p->end = NULL;
+        p->error = JSON_ERROR_IO;
+        json__parse_clear_position(p);
+        return NULL;
+    }
+    json_document *doc = json_document_from_buffer_ex(p, f.data, f.size);
+    p->cur = p->end = NULL;
+    if (doc && (p->flags & (JSON_PARSE_STRING_VIEWS | JSON_PARSE_LAZY))) {
+        doc->source = f.data;
+        doc->source_size = f.size;
+        doc->source_mapped = f.mapped;
+    } else {
+        json__file_close(&f);
+    }
+    return doc;
+}
+
+json_document *json_document_from_buffer(const char *data, size_t len) {
+    json_parser p = {0};
+    return json_document_from_buffer_ex(&p, data, len);
+}
+
+json_document *json_document_from_string(const char *string) {
+    json_parser p = {0};
+    return json_document_from_string_ex(&p, string);
+}
+
+json_document *json_document_from_file(const char *path) {
+    json_parser p = {0};
+    return json_document_from_file_ex(&p, path);
+}
+
+json_value *json_document_root(json_document *doc) {
+    return doc ? doc->root : NULL;
+}
+
+json_error json_document_error(json_document *doc) {
+    return doc ? doc->arena.error : JSON_ERROR_NONE;
+}
+
+void json_document_free(json_document **doc) {
+    if (!doc || !*doc)
+        return;
+
+    json_arena a = (*doc)->arena;
+    json__arena_free(&a);
+    json_intern_table_free(&(*doc)->intern);
+    if ((*doc)->source) {
+        json__file f = {(*doc)->source, (*doc)->source_size, (*doc)->source_mapped};
+        json__file_close(&f);
+    }
+    json__chunk_free(&a, *doc);
+    *doc = NULL;
+}
+
+static int json__is_structural(char c) {
+    return c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',' || c == '"';
+}
+
+// Stage one of the tape engine: the offset of every structural character and
+// of the first byte of every scalar, with string contents skipped over.
+static uint32_t *json__tape_index(json_parser *p, size_t *count) {
+    const char *base = p->cur;
+    size_t n = 0;
+    size_t cap = 64;
+    uint32_t *index = json__heap_alloc(cap * sizeof *index);
+    if (!index) {
+        p->error = JSON_ERROR_MEMORY;
+        return NULL;
+    }
+    while (1) {
+        json__skip_whitespace(p);
+        if (p->cur >= p->end)
+            break;
+        if (n == cap) {
+            uint32_t *temp = json__heap_realloc(index, (cap *= 2) * sizeof *index);
+            if (!temp) {
+                json__heap_free(index);
+                p->error = JSON_ERROR_MEMORY;
+                return NULL;
+            }
+            index = temp;
+        }
+        index[n++] = (uint32_t)(p->cur - base);
+        if (*p->cur == '"') {
+            p->cur++;
+            int escaped;
+            if (!json__skip_string(p, &escaped)) {
+                json__heap_free(index);
+                return NULL;
+            }
+            p->cur++;
+        } else if (json__is_structural(*p->cur)) {
+            p->cur++;
+        } else {
+            while (p->cur < p->end && !json__is_space(*p->cur) && !json__is_structural(*p->cur))
+                p->cur++;
+        }
+    }
+    *count = n;
+    return index;
+}
+
+static int json__tape_push(json_tape *t, json_parser *p, uint64_t e) {
+    if (t->count == t->cap) {
+        size_t cap = t->cap ? t->cap * 2 : 64;
+        uint64_t *temp = json__heap_realloc(t->tape, cap * sizeof *temp);
+        if (!temp) {
+            p->error = JSON_ERROR_MEMORY;
+            return 0;
+        }
+        t->tape = temp;
+        t->cap = cap;
+    }
+    t->tape[t->count++] = e;
+    return 1;
+}
+
+static int json__tape_string(json_tape *t, json_parser *p) {
+    p->cur++;
+    const char *s = p->cur;
+    int escaped;
+    if (!json__skip_string(p, &escaped))
+        return 0;
+    const char *close = p->cur;
+    size_t l = close - s;
+    if (!json__string_check(p, s, l))
+        return 0;
+    size_t need = t->strings_len + sizeof(uint32_t) + l + 1;
+    if (need > t->strings_cap) {
+        size_t cap = t->strings_cap ? t->strings_cap : 256;
+        while (cap < need)
+            cap *= 2;
+        char *temp = json__heap_realloc(t->strings, cap);
+        if (!temp) {
+            p->error = JSON_ERROR_MEMORY;
+            return 0;
+        }
+        t->strings = temp;
+        t->strings_cap = cap;
+    }
+    size_t offset = t->strings_len;
+    char *x = t->strings + offset + sizeof(uint32_t);
+    if (escaped) {
+        l = json__unescape(p, x, s, l);
+        if (l == SIZE_MAX)
+            return 0;
+    } else {
+        memcpy(x, s, l);
+    }
+    uint32_t l32 = (uint32_t)l;
+    memcpy(t->strings + offset, &l32, sizeof l32);
+    x[l] = '\0';
+    t->strings_len = offset + sizeof l32 + l + 1;
+    p->cur = close + 1;
+    return json__tape_push(t, p, JSON__TAPE_ENTRY('"', offset));
+}
+
+static int json__tape_scalar(json_tape *t, json_parser *p) {
+    if (*p->cur == '"')
+        return json__tape_string(t, p);
+    if (json__match_literal(p, "true", 4))
+        return json__tape_push(t, p, JSON__TAPE_ENTRY('t', 0));
+    if (json__match_literal(p, "false", 5))
+        return json__tape_push(t, p, JSON__TAPE_ENTRY('f', 0));
+    if (json__match_literal(p, "null", 4))
+        return json__tape_push(t, p, JSON__TAPE_ENTRY('n', 0));
+    if (*p->cur == '-' || isdigit((unsigned char)*p->cur)) {
+        double n;
+        int64_t i;
+        int is_integer;
+        uint64_t bits;
+        if (!json__parse_number(p, &n, &i, &is_integer))
+            return 0;
+        if (is_integer)
+            return json__tape_push(t, p, JSON__TAPE_ENTRY('l', 0)) && json__tape_push(t, p, (uint64_t)i);
+        memcpy(&bits, &n, sizeof bits);
+        return json__tape_push(t, p, JSON__TAPE_ENTRY('d', 0)) && json__tape_push(t, p, bits);
+    }
+    return 0;
+}
+
+// Stage two: walk the structural index with an explicit container stack and
+// emit the tape. Containers are written as an opening entry holding the
+// element count and the index just past the matching close entry, so
+// siblings can be skipped without scanning the subtree.
+static int json__tape_build(json_tape *t, json_parser *p, const uint32_t *index, size_t n) {
+    enum { VALUE, VALUE_OR_CLOSE, KEY, KEY_OR_CLOSE, COLON, NEXT, DONE } state = VALUE;
+    struct { size_t open; size_t count; char kind; } *stack = NULL;
+    size_t depth = 0;
+    size_t stack_cap = 0;
+    const char *base = p->cur;
+
+    for (size_t i = 0; i < n; i++) {
+        const char *tok = base + index[i];
+        char c = *tok;
+        p->cur = tok;
+        switch (state) {
+            case KEY_OR_CLOSE:
+                if (c == '}')
+                    goto close;
+                // fallthrough
+            case KEY:
+                if (c != '"' || !json__tape_string(t, p))
+                    goto fail;
+                stack[depth - 1].count++;
+                state = COLON;
+                goto check_end;
+            case COLON:
+                if (c != ':')
+                    goto fail;
+                state = VALUE;
+                continue;
+            case NEXT:
+                if (c == ',') {
+                    state = stack[depth - 1].kind == '{' ? KEY : VALUE;
+                    continue;
+                }
+                if (c == '}' || c == ']')
+                    goto close;
+                goto fail;
+            case DONE:
+                goto fail;
+            case VALUE_OR_CLOSE:
+                if (c == ']')
+                    goto close;
+                // fallthrough
+            case VALUE:
+                if (depth && stack[depth - 1].kind == '[')
+                    stack[depth - 1].count++;
+                if (c == '{' || c == '[') {
+                    if (depth == json__max_depth(p)) {
+                        p->error = JSON_ERROR_DEPTH;
+                        goto fail;
+                    }
+                    if (depth == stack_cap) {
+                        stack_cap = stack_cap ? stack_cap * 2 : 16;
+                        void *temp = json__heap_realloc(stack, stack_cap * sizeof *stack);
+                        if (!temp) {
+                            p->error = JSON_ERROR_MEMORY;
+                            goto fail;
+                        }
+                        stack = temp;
+                    }
+                    stack[depth].open = t->count;
+                    stack[depth].count = 0;
+                    stack[depth].kind = c;
+                    depth++;
+                    if (!json__tape_push(t, p, 0))
+                        goto fail;
+                    state = c == '{' ? KEY_OR_CLOSE : VALUE_OR_CLOSE;
+                    continue;
+                }
+                if (!json__tape_scalar(t, p))
+                    goto fail;
+                state = depth ? NEXT : DONE;
+                goto check_end;
+        }
+
+    close:
+        if (stack[depth - 1].kind != (c == '}' ? '{' : '['))
+            goto fail;
+        depth--;
+        size_t open = stack[depth].open;
+        size_t count = stack[depth].count < 0xFFFFFF ? stack[depth].count : 0xFFFFFF;
+        if (t->count + 1 > 0xFFFFFFFF) {
+            p->error = JSON_ERROR_TOO_LARGE;
+            goto fail;
+        }
+        t->tape[open] = JSON__TAPE_ENTRY(stack[depth].kind, ((uint64_t)count << 32) | (t->count + 1));
+        if (!json__tape_push(t, p, JSON__TAPE_ENTRY(c, open)))
+            goto fail;
+        state = depth ? NEXT : DONE;
+        continue;
+
+    check_end:
+        // A scalar must run exactly up to the next indexed token.
+        json__skip_whitespace(p);
+        if (p->cur != (i + 1 < n ? base + index[i + 1] : p->end))
+            goto fail;
+    }
+    p->cur = p->end;
+    if (state != DONE)
+        goto fail;
+    json__heap_free(stack);
+    return 1;
+
+fail:
+    if (p->error == JSON_ERROR_NONE)
+        p->error = JSON_ERROR_SYNTAX;
+    json__heap_free(stack);
+    return 0;
+}
+
+json_tape *json_tape_from_buffer_ex(json_parser *p, const char *data, size_t len) {
+    JSON__STATS_CLOCK(start);
+    p->cur = data;
+    p->end = data + len;
+    p->error = JSON_ERROR_NONE;
+    json_tape *t = NULL;
+    if (len > 0xFFFFFFFF) {
+        p->error = JSON_ERROR_TOO_LARGE;
+        goto done;
+    }
+
+    size_t n;
+    uint32_t *index = json__tape_index(p, &n);
+    if (!index) {
+        if (p->error == JSON_ERROR_NONE)
+            p->error = JSON_ERROR_SYNTAX;
+        goto done;
+    }
+
+    t = json__heap_calloc(1, sizeof *t);
+    if (!t) {
+        json__heap_free(index);
+        p->error = JSON_ERROR_MEMORY;
+        goto done;
+    }
+    p->cur = data;
+    if (!json__tape_build(t, p, index, n))
+        json_tape_free(&t);
+    json__heap_free(index);
+
+done:
+    json__parse_position(p, data);
+    JSON__STATS_ADD(parses, 1);
+    JSON__STATS_ADD(bytes_parsed, len);
+    JSON__STATS_ELAPSED(parse_ns, start);
+    return t;
+}
+
+json_tape *json_tape_from_buffer(const char *data, size_t len) {
+    json_parser p = {0};
+    return json_tape_from_buffer_ex(&p, data, len);
+}
+
+json_tape *json_tape_from_string(const char *string) {
+    return json_tape_from_buffer(string, strlen(string));
+}
+
+json_tape *json_tape_from_file(const char *path) {
+    json__file f;
+    if (!json__file_open(&f, path))
+        return NULL;
+    json_tape *t = json_tape_from_buffer(f.data, f.size);
+    json__file_close(&f);
+    return t;
+}
+
+void json_tape_free(json_tape **t) {
+    if (!t || !*t)
+        return;
+
+    json__heap_free((*t)->tape);
+    json__heap_free((*t)->strings);
+    json__heap_free(*t);
+    *t = NULL;
+}
+
+size_t json_tape_root(json_tape *t) {
+    return t && t->count ? 0 : JSON_TAPE_NONE;
+}
+
+static size_t json__tape_next(json_tape *t, size_t i) {
+    char tag = JSON__TAPE_TAG(t->tape[i]);
+    if (tag == '{' || tag == '[')
+        return (size_t)(t->tape[i] & 0xFFFFFFFF);
+    if (tag == 'd' || tag == 'l')
+        return i + 2;
+    return i + 1;
+}
+
+json_type json_tape_type(json_tape *t, size_t i) {
+    switch (JSON__TAPE_TAG(t->tape[i])) {
+        case '{': return JSON_OBJECT;
+        case '[': return JSON_ARRAY;
+        case '"': return JSON_STRING;
+        case 'd':
+        case 'l': return JSON_NUMBER;
+        case 't':
+        case 'f': return JSON_BOOL;
+        default: return JSON_NULL;
+    }
+}
+
+size_t json_tape_count(json_tape *t, size_t i) {
+    char tag = JSON__TAPE_TAG(t->tape[i]);
+    if (tag != '{' && tag != '[')
+        return 0;
+    size_t count = (size_t)((t->tape[i] >> 32) & 0xFFFFFF);
+    if (count < 0xFFFFFF)
+        return count;
+    // Counts are saturated on the tape; fall back to walking the elements.
+    count = 0;
+    size_t end = json__tape_next(t, i) - 1;
+    for (size_t j = i + 1; j < end; j = json__tape_next(t, j)) {
+        if (tag == '{')
+            j++;
+        count++;
+    }
+    return count;
+}
+
+size_t json_tape_get(json_tape *t, size_t obj, const char *key) {
+    if (obj == JSON_TAPE_NONE || JSON__TAPE_TAG(t->tape[obj]) != '{')
+        return JSON_TAPE_NONE;
+
+    size_t l = strlen(key);
+    size_t end = json__tape_next(t, obj) - 1;
+    for (size_t i = obj + 1; i < end; i = json__tape_next(t, i + 1)) {
+        const char *s = t->strings + JSON__TAPE_PAYLOAD(t->tape[i]);
+        uint32_t sl;
+        memcpy(&sl, s, sizeof sl);
+        if (sl == l && memcmp(s + sizeof sl, key, l) == 0)
+            return i + 1;
+    }
+    return JSON_TAPE_NONE;
+}
+
+size_t json_tape_geti(json_tape *t, size_t arr, size_t index) {
+    if (arr == JSON_TAPE_NONE || JSON__TAPE_TAG(t->tape[arr]) != '[')
+        return JSON_TAPE_NONE;
+
+    size_t end = json__tape_next(t, arr) - 1;
+    for (size_t i = arr + 1; i < end; i = json__tape_next(t, i))
+        if (index-- == 0)
+            return i;
+    return JSON_TAPE_NONE;
+}
+
+const char *json_tape_query_string(json_tape *t, size_t i) {
+    return t->strings + JSON__TAPE_PAYLOAD(t->tape[i]) + sizeof(uint32_t);
+}
+
+size_t json_tape_query_string_len(json_tape *t, size_t i) {
+    uint32_t l;
+    memcpy(&l, t->strings + JSON__TAPE_PAYLOAD(t->tape[i]), sizeof l);
+    return l;
+}
+
+double json_tape_query_number(json_tape *t, size_t i) {
+    if (JSON__TAPE_TAG(t->tape[i]) == 'l')
+        return (double)(int64_t)t->tape[i + 1];
+    double n;
+    memcpy(&n, &t->tape[i + 1], sizeof n);
+    return n;
+}
+
+int64_t json_tape_query_integer(json_tape *t, size_t i) {
+    if (JSON__TAPE_TAG(t->tape[i]) == 'l')
+        return (int64_t)t->tape[i + 1];
+    return json__double_to_integer(json_tape_query_number(t, i));
+}
+
+int json_tape_query_boolean(json_tape *t, size_t i) {
+    return JSON__TAPE_TAG(t->tape[i]) == 't';
+}
+
+// Iterative and allocation-free: a container part way through being freed
+// keeps its remaining children in items[0, count) and, in a field it no
+// longer needs, a link up to the container it was found in.
+void json_free(json_value **root) {
+    if(!root || !*root)
+        return; 
+
+    json_value *v = *root;
+    json_value *up = NULL;
+    *root = NULL;
+    while (1) {
+        if (v && !(v->flags & JSON__FLAG_ARENA)) {
+            switch (v->type) {
+                case JSON_OBJECT:
+                    json__heap_free(v->object.index);
+                    if (v->object.count) {
+                        v->object.up = up;
+                        up = v;
+                        v = NULL;
+                        continue;
+                    }
+                    json__heap_free(v->object.items);
+                    break;
+                case JSON_ARRAY:
+                    if (v->array.items == v->array.small && v->array.count) {
+                        json_value *child = v->array.small[0];
+                        json__node_release(v);
+                        v = child;
+                        continue;
+                    }
+                    if (v->array.count) {
+                        v->array.small[0] = up;
+                        up = v;
+                        v = NULL;
+                        continue;
+                    }
+                    if (v->array.items != v->array.small)
+                        json__heap_free(v->array.items);
+                    break;
+                case JSON_STRING:
+                    if (!(v->flags & JSON__FLAG_BORROWED))
+                        json__heap_free(v->string.data);
+                    break;
+                default:
+                    break;
+            }
+            json__node_release(v);
+        }
+
+        if (!up)
+            return;
+        if (up->type == JSON_OBJECT) {
+            kvp *e = &up->object.items[--up->object.count];
+            if (!e->key_borrowed)
+                json__heap_free(e->key);
+            v = e->val;
+            if (!up->object.count) {
+                json_value *next = up->object.up;
+                json__heap_free(up->object.items);
+                json__node_release(up);
+                up = next;
+            }
+        } else {
+            v = up->array.items[--up->array.count];
+            if (!up->array.count) {
+                json_value *next = up->array.small[0];
+                json__heap_free(up->array.items);
+                json__node_release(up);
+                up = next;
+            }
+        }
+    }
+}
+
+typedef struct {
+    json_value *src;
+    json_value *dst;
+    size_t next;
+    char *key;
+} json__clone_frame;
+
+static int json__grow_stack(void **stack, void *small, size_t small_size, size_t *cap, size_t size) {
+    void *temp = *stack == small ? json__heap_alloc(2 * *cap * size) : json__heap_realloc(*stack, 2 * *cap * size);
+    if (!temp)
+        return 0;
+    if (*stack == small)
+        memcpy(temp, small, small_size);
+    *stack = temp;
+    *cap *= 2;
+    return 1;
+}
+
+static size_t json__index_size(size_t count) {
+    if (count < JSON_OBJECT_INDEX_THRESHOLD)
+        return 0;
+    size_t slots = 2 * JSON_OBJECT_INDEX_THRESHOLD;
+    while (slots < 2 * count + 2)
+        slots *= 2;
+    return json__arena_align((1 + slots) * sizeof(uint32_t));
+}
+
+// The arena bytes json__clone will take for v, or SIZE_MAX if the walk
+// itself runs out of memory. Lazy containers are materialized on the way.
+static size_t json__clone_size(json_value *v) {
+    json__clone_frame small[32];
+    json__clone_frame *stack = small;
+    size_t depth = 0;
+    size_t cap = sizeof small / sizeof *small;
+    size_t size = 0;
+
+    while (1) {
+        if (v) {
+            json__materialize(v);
+            if (v->type == JSON_OBJECT || v->type == JSON_ARRAY || v->type == JSON_STRING || v->type == JSON_NUMBER)
+                size += json__arena_align(sizeof *v);
+            if (v->type == JSON_STRING)
+                size += json__arena_align(v->string.len + 1);
+            if (v->type == JSON_OBJECT) {
+                size += json__arena_align(v->object.count * sizeof(kvp)) + json__index_size(v->object.count);
+                for (size_t i = 0; i < v->object.count; i++)
+                    size += json__arena_align(v->object.items[i].key_len + 1);
+            }
+            if (v->type == JSON_ARRAY && v->array.count > 1)
+                size += json__arena_align(v->array.count * sizeof(json_value *));
+            if (v->type == JSON_OBJECT || v->type == JSON_ARRAY) {
+                if (depth == cap && !json__grow_stack((void **)&stack, small, sizeof small, &cap, sizeof *stack)) {
+                    size = SIZE_MAX;
+                    break;
+                }
+                stack[depth++] = (json__clone_frame){v, NULL, 0, NULL};
+            }
+        }
+        v = NULL;
+        while (depth) {
+            json__clone_frame *f = &stack[depth - 1];
+            if (f->src->type == JSON_OBJECT && f->next < f->src->object.count) {
+                v = f->src->object.items[f->next++].val;
+                break;
+            }
+            if (f->src->type == JSON_ARRAY && f->next < f->src->array.count) {
+                v = f->src->array.items[f->next++];
+                break;
+            }
+            depth--;
+        }
+        if (!depth && !v)
+            break;
+    }
+    if (stack != small)
+        json__heap_free(stack);
+    return size;
+}
+
+static json_value *json__clone_node(json_arena *a, json_value *v) {
+    json_type t = v ? v->type : JSON_NULL;
+    if (a && t == JSON_NULL)
+        return &json__null;
+    if (a && t == JSON_BOOL)
+        return v->boolean ? &json__true : &json__false;
+
+    json_value *x = json__new_value(a, t);
+    if (!x)
+        return NULL;
+    if (t == JSON_STRING) {
+        if (!(x->string.data = json__alloc(a, v->string.len + 1))) {
+            json_free(&x);
+            return NULL;
+        }
+        memcpy(x->string.data, v->string.data, v->string.len);
+        x->string.data[v->string.len] = '\0';
+        x->string.len = v->string.len;
+    } else if (t == JSON_NUMBER) {
+        x->flags |= v->flags & JSON__FLAG_INTEGER;
+        if (v->flags & JSON__FLAG_INTEGER)
+            x->integer = v->integer;
+        else
+            x->number = v->number;
+    } else if (t == JSON_BOOL) {
+        x->boolean = v->boolean;
+    } else if (t == JSON_OBJECT && v->object.count) {
+        if (!(x->object.items = json__alloc(a, v->object.count * sizeof(kvp)))) {
+            json_free(&x);
+            return NULL;
+        }
+        x->object.cap = v->object.count;
+    } else if (t == JSON_ARRAY && v->array.count == 1) {
+        x->array.items = x->array.small;
+        x->array.cap = 1;
+    } else if (t == JSON_ARRAY && v->array.count) {
+        if (!(x->array.items = json__alloc(a, v->array.count * sizeof(json_value *)))) {
+            json_free(&x);
+            return NULL;
+        }
+        x->array.cap = v->array.count;
+    }
+    return x;
+}
+
+// Copies v with every item buffer sized exactly and every string and key
+// owned by the copy. Like the parser it attaches each node as it is made,
+// so a failure leaves one tree to free.
+static json_value *json__clone(json_arena *a, json_value *v) {
+    json__clone_frame small[32];
+    json__clone_frame *stack = small;
+    size_t depth = 0;
+    size_t cap = sizeof small / sizeof *small;
+    json_value *root = NULL;
+
+    while (1) {
+        if (v)
+            json__materialize(v);
+        json_value *x = json__clone_node(a, v);
+        if (!x)
+            goto fail;
+        if (!depth) {
+            root = x;
+        } else {
+            json__clone_frame *f = &stack[depth - 1];
+            if (f->dst->type == JSON_OBJECT) {
+                kvp *e = &f->src->object.items[f->dst->object.count];
+                f->dst->object.items[f->dst->object.count++] = (kvp){f->key, x, e->key_len, 0, 0};
+                f->key = NULL;
+            } else {
+                f->dst->array.items[f->dst->array.count++] = x;
+            }
+        }
+        if (v && (v->type == JSON_OBJECT || v->type == JSON_ARRAY)) {
+            if (depth == cap && !json__grow_stack((void **)&stack, small, sizeof small, &cap, sizeof *stack))
+                goto fail;
+            stack[depth++] = (json__clone_frame){v, x, 0, NULL};
+        }
+
+        // Step to the next child, copying its key, or finish every
+        // container that has none left.
+        int pending = 0;
+        while (depth) {
+            json__clone_frame *f = &stack[depth - 1];
+            if (f->src->type == JSON_OBJECT && f->next < f->src->object.count) {
+                kvp *e = &f->src->object.items[f->next++];
+                if (!(f->key = json__alloc(a, e->key_len + 1)))
+                    goto fail;
+                memcpy(f->key, e->key, e->key_len);
+                f->key[e->key_len] = '\0';
+                v = e->val;
+                pending = 1;
+                break;
+            }
+            if (f->src->type == JSON_ARRAY && f->next < f->src->array.count) {
+                v = f->src->array.items[f->next++];
+                pending = 1;
+                break;
+            }
+            if (f->dst->type == JSON_OBJECT && f->dst->object.count >= JSON_OBJECT_INDEX_THRESHOLD)
+                json__object_build_index(a, &f->dst->object);
+            depth--;
+        }
+        if (!pending)
+            break;
+    }
+    if (stack != small)
+        json__heap_free(stack);
+    return root;
+
+fail:
+    if (depth)
+        json__free(a, stack[depth - 1].key);
+    json_free(&root);
+    if (stack != small)
+        json__heap_free(stack);
+    return NULL;
+}
+
+json_value *json_clone(json_value *v) {
+    return v ? json__clone(NULL, v) : NULL;
+}
+
+// A sizing pass first, so the copy takes a single allocation.
+json_document *json_document_clone(json_value *v) {
+    if (!v)
+        return NULL;
+    size_t size = json__clone_size(v);
+    json_document *doc = json__document_new(NULL);
+    if (size == SIZE_MAX || !doc || (size && !json__arena_reserve(&doc->arena, size))) {
+        json_document_free(&doc);
+        return NULL;
+    }
+    doc->root = json__clone(&doc->arena, v);
+    if (!doc->root)
+        json_document_free(&doc);
+    return doc;
+}
+
+// Integral doubles compare and hash as the integers they equal, so 1 and
+// 1.0 agree.
+static int json__number_integral(json_value *v, int64_t *i) {
+    if (v->flags & JSON__FLAG_INTEGER) {
+        *i = v->integer;
+        return 1;
+    }
+    double d = v->number;
+    if (!(d >= -9223372036854775808.0 && d < 9223372036854775808.0) || d != (double)(int64_t)d)
+        return 0;
+    *i = (int64_t)d;
+    return 1;
+}
+
+typedef struct {
+    json_value *a;
+    json_value *b;
+    size_t next;
+} json__equal_frame;
+
+// Compares a against b up to their children, which json_equal then visits.
+static int json__equal_shallow(json_value *a, json_value *b) {
+    static json_value null = {.type = JSON_NULL};
+    if (!a)
+        a = &null;
+    if (!b)
+        b = &null;
+    json__materialize(a);
+    json__materialize(b);
+    if (a->type != b->type)
+        return 0;
+    int64_t ia, ib;
+    int integral;
+    switch (a->type) {
+        case JSON_OBJECT:
+            return a->object.count == b->object.count;
+        case JSON_ARRAY:
+            return a->array.count == b->array.count;
+        case JSON_STRING:
+            return a->string.len == b->string.len && memcmp(a->string.data, b->string.data, a->string.len) == 0;
+        case JSON_NUMBER:
+            integral = json__number_integral(a, &ia);
+            if (integral != json__number_integral(b, &ib))
+                return 0;
+            return integral ? ia == ib : a->number == b->number;
+        case JSON_BOOL:
+            return !a->boolean == !b->boolean;
+        default:
+            return 1;
+    }
+}
+
+int json_equal(json_value *a, json_value *b) {
+    json__equal_frame small[32];
+    json__equal_frame *stack = small;
+    size_t depth = 0;
+    size_t cap = sizeof small / sizeof *small;
+    int equal = 1;
+
+    while (1) {
+        // Shared subtrees, such as the read-only true/false/null nodes or a
+        // tree compared with itself, are equal without a walk.
+        if (a != b) {
+            if (!json__equal_shallow(a, b)) {
+                equal = 0;
+                break;
+            }
+            if (a && (a->type == JSON_OBJECT || a->type == JSON_ARRAY)) {
+                if (depth == cap && !json__grow_stack((void **)&stack, small, sizeof small, &cap, sizeof *stack)) {
+                    equal = 0;
+                    break;
+                }
+                stack[depth++] = (json__equal_frame){a, b, 0};
+            }
+        }
+
+        // Members are matched by key, in whatever order b has them.
+        int pending = 0;
+        while (depth && !pending) {
+            json__equal_frame *f = &stack[depth - 1];
+            if (f->a->type == JSON_OBJECT && f->next < f->a->object.count) {
+                kvp *e = &f->a->object.items[f->next++];
+                kvp *m = json__object_find(&f->b->object, e->key, e->key_len);
+                if (!m) {
+                    equal = 0;
+                    break;
+                }
+                a = e->val;
+                b = m->val;
+                pending = 1;
+            } else if (f->a->type == JSON_ARRAY && f->next < f->a->array.count) {
+                a = f->a->array.items[f->next];
+                b = f->b->array.items[f->next++];
+                pending = 1;
+            } else {
+                depth--;
+            }
+        }
+        if (!pending)
+            break;
+    }
+    if (stack != small)
+        json__heap_free(stack);
+    return equal;
+}
+
+static uint64_t json__mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+static uint64_t json__hash64(const char *s, size_t l) {
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < l; i++)
+        h = (h ^ (unsigned char)s[i]) * 1099511628211ull;
+    return h;
+}
+
+typedef struct {
+    json_value *container;
+    size_t next;
+    uint64_t acc;
+} json__hash_frame;
+
+static uint64_t json__hash_scalar(json_value *v) {
+    int64_t i;
+    uint64_t bits;
+    switch (v ? v->type : JSON_NULL) {
+        case JSON_STRING:
+            return json__mix(json__hash64(v->string.data, v->string.len) ^ JSON_STRING);
+        case JSON_NUMBER:
+            if (json__number_integral(v, &i))
+                return json__mix((uint64_t)i ^ 0x9e3779b97f4a7c15ull);
+            memcpy(&bits, &v->number, sizeof bits);
+            return json__mix(bits);
+        case JSON_BOOL:
+            return json__mix(v->boolean ? 0x2545f4914f6cdd1dull : 0x5851f42d4c957f2dull);
+        default:
+            return json__mix(JSON_NULL);
+    }
+}
+
+// Arrays fold their elements in order. Objects add up one hash per member,
+// which no ordering of the members can change.
+uint64_t json_hash(json_value *v) {
+    json__hash_frame small[32];
+    json__hash_frame *stack = small;
+    size_t depth = 0;
+    size_t cap = sizeof small / sizeof *small;
+    uint64_t h = 0;
+
+    while (1) {
+        if (v)
+            json__materialize(v);
+        if (v && (v->type == JSON_OBJECT || v->type == JSON_ARRAY)) {
+            if (depth == cap && !json__grow_stack((void **)&stack, small, sizeof small, &cap, sizeof *stack)) {
+                h = 0;
+                break;
+            }
+            stack[depth++] = (json__hash_frame){v, 0, 0};
+        } else {
+            h = json__hash_scalar(v);
+        }
+
+        int pending = 0;
+        while (depth && !pending) {
+            json__hash_frame *f = &stack[depth - 1];
+            json_value *c = f->container;
+            size_t count = c->type == JSON_OBJECT ? c->object.count : c->array.count;
+            // h is the hash of the child just finished, if any.
+            if (f->next) {
+                if (c->type == JSON_OBJECT) {
+                    kvp *e = &c->object.items[f->next - 1];
+                    f->acc += json__mix(json__hash64(e->key, e->key_len) ^ json__mix(h));
+                } else {
+                    f->acc = json__mix(f->acc ^ h) + f->next;
+                }
+            }
+            if (f->next < count) {
+                v = c->type == JSON_OBJECT ? c->object.items[f->next].val : c->array.items[f->next];
+                f->next++;
+                pending = 1;
+            } else {
+                h = json__mix(f->acc ^ ((uint64_t)count << 8 | c->type));
+                depth--;
+            }
+        }
+        if (!pending)
+            break;
+    }
+    if (stack != small)
+        json__heap_free(stack);
+    return h;
+}
+
+// Shortest round-trip double formatting with Grisu2 (Loitsch, "Printing
+// Floating-Point Numbers Quickly and Accurately with Integers"). The output
+// always parses back to the same double and is the shortest such string in
+// all but a tiny fraction of cases.
+typedef struct {
+    uint64_t f;
+    int e;
+} json__diyfp;
+
+static const uint64_t json__cached_powers_f[] = {
+    0xfa8fd5a0081c0288ull, 0xbaaee17fa23ebf76ull, 0x8b16fb203055ac76ull, 0xcf42894a5dce35eaull,
+    0x9a6bb0aa55653b2dull, 0xe61acf033d1a45dfull, 0xab70fe17c79ac6caull, 0xff77b1fcbebcdc4full,
+    0xbe5691ef416bd60cull, 0x8dd01fad907ffc3cull, 0xd3515c2831559a83ull, 0x9d71ac8fada6c9b5ull,
+    0xea9c227723ee8bcbull, 0xaecc49914078536dull, 0x823c12795db6ce57ull, 0xc21094364dfb5637ull,
+    0x9096ea6f3848984full, 0xd77485cb25823ac7ull, 0xa086cfcd97bf97f4ull, 0xef340a98172aace5ull,
+    0xb23867fb2a35b28eull, 0x84c8d4dfd2c63f3bull, 0xc5dd44271ad3cdbaull, 0x936b9fcebb25c996ull,
+    0xdbac6c247d62a584ull, 0xa3ab66580d5fdaf6ull, 0xf3e2f893dec3f126ull, 0xb5b5ada8aaff80b8ull,
+    0x87625f056c7c4a8bull, 0xc9bcff6034c13053ull, 0x964e858c91ba2655ull, 0xdff9772470297ebdull,
+    0xa6dfbd9fb8e5b88full, 0xf8a95fcf88747d94ull, 0xb94470938fa89bcfull, 0x8a08f0f8bf0f156bull,
+    0xcdb02555653131b6ull, 0x993fe2c6d07b7facull, 0xe45c10c42a2b3b06ull, 0xaa242499697392d3ull,
+    0xfd87b5f28300ca0eull, 0xbce5086492111aebull, 0x8cbccc096f5088ccull, 0xd1b71758e219652cull,
+    0x9c40000000000000ull, 0xe8d4a51000000000ull, 0xad78ebc5ac620000ull, 0x813f3978f8940984ull,
+    0xc097ce7bc90715b3ull, 0x8f7e32ce7bea5c70ull, 0xd5d238a4abe98068ull, 0x9f4f2726179a2245ull,
+    0xed63a231d4c4fb27ull, 0xb0de65388cc8ada8ull, 0x83c7088e1aab65dbull, 0xc45d1df942711d9aull,
+    0x924d692ca61be758ull, 0xda01ee641a708deaull, 0xa26da3999aef774aull, 0xf209787bb47d6b85ull,
+    0xb454e4a179dd1877ull, 0x865b86925b9bc5c2ull, 0xc83553c5c8965d3dull, 0x952ab45cfa97a0b3ull,
+    0xde469fbd99a05fe3ull, 0xa59bc234db398c25ull, 0xf6c69a72a3989f5cull, 0xb7dcbf5354e9beceull,
+    0x88fcf317f22241e2ull, 0xcc20ce9bd35c78a5ull, 0x98165af37b2153dfull, 0xe2a0b5dc971f303aull,
+    0xa8d9d1535ce3b396ull, 0xfb9b7cd9a4a7443cull, 0xbb764c4ca7a44410ull, 0x8bab8eefb6409c1aull,
+    0xd01fef10a657842cull, 0x9b10a4e5e9913129ull, 0xe7109bfba19c0c9dull, 0xac2820d9623bf429ull,
+    0x80444b5e7aa7cf85ull, 0xbf21e44003acdd2dull, 0x8e679c2f5e44ff8full, 0xd433179d9c8cb841ull,
+    0x9e19db92b4e31ba9ull, 0xeb96bf6ebadf77d9ull, 0xaf87023b9bf0ee6bull
+};
+
+static const int16_t json__cached_powers_e[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066
+};
+
+static const uint64_t json__pow10_u64[] = {
+    1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull,
+    100000000ull, 1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull,
+    10000000000000ull, 100000000000000ull, 1000000000000000ull, 10000000000000000ull,
+    100000000000000000ull, 1000000000000000000ull, 10000000000000000000ull
+};
+
+static json__diyfp json__diyfp_mul(json__diyfp x, json__diyfp y) {
+    const uint64_t m32 = 0xFFFFFFFFu;
+    uint64_t a = x.f >> 32, b = x.f & m32, c = y.f >> 32, d = y.f & m32;
+    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    uint64_t tmp = (bd >> 32) + (ad & m32) + (bc & m32);
+    tmp += 1u << 31;
+    json__diyfp r = {ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), x.e + y.e + 64};
+    return r;
+}
+
+static json__diyfp json__diyfp_normalize(json__diyfp x) {
+    while (!(x.f & (1ull << 63))) {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+static void json__grisu_round(char *buffer, int len, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w) {
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+        buffer[len - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+static int json__count_digits_u32(uint32_t n) {
+    int d = 1;
+    while (d < 10 && n >= json__pow10_u64[d])
+        d++;
+    return d;
+}
+
+static void json__grisu_digits(json__diyfp w, json__diyfp mp, uint64_t delta, char *buffer, int *len, int *k) {
+    json__diyfp one = {1ull << -mp.e, mp.e};
+    uint64_t wp_w = mp.f - w.f;
+    uint32_t p1 = (uint32_t)(mp.f >> -one.e);
+    uint64_t p2 = mp.f & (one.f - 1);
+    int kappa = json__count_digits_u32(p1);
+    *len = 0;
+
+    while (kappa > 0) {
+        uint32_t d = p1 / (uint32_t)json__pow10_u64[kappa - 1];
+        p1 %= (uint32_t)json__pow10_u64[kappa - 1];
+        if (d || *len)
+            buffer[(*len)++] = (char)('0' + d);
+        kappa--;
+        uint64_t rest = ((uint64_t)p1 << -one.e) + p2;
+        if (rest <= delta) {
+            *k += kappa;
+            json__grisu_round(buffer, *len, delta, rest, json__pow10_u64[kappa] << -one.e, wp_w);
+            return;
+        }
+    }
+
+    while (1) {
+        p2 *= 10;
+        delta *= 10;
+        char d = (char)(p2 >> -one.e);
+        if (d || *len)
+            buffer[(*len)++] = (char)('0' + d);
+        p2 &= one.f - 1;
+        kappa--;
+        if (p2 < delta) {
+            *k += kappa;
+            json__grisu_round(buffer, *len, delta, p2, one.f, wp_w * (-kappa < 20 ? json__pow10_u64[-kappa] : 0));
+            return;
+        }
+    }
+}
+
+// Writes the significant digits of a positive, finite d and returns their
+// count; d == digits * 10^*k.
+static int json__grisu2(double d, char *buffer, int *k) {
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof bits);
+    int biased_e = (int)((bits >> 52) & 0x7FF);
+    uint64_t significand = bits & ((1ull << 52) - 1);
+    json__diyfp v;
+    if (biased_e) {
+        v.f = significand + (1ull << 52);
+        v.e = biased_e - 1075;
+    } else {
+        v.f = significand;
+        v.e = -1074;
+    }
+
+    json__diyfp plus = {(v.f << 1) + 1, v.e - 1};
+    while (!(plus.f & (1ull << 53))) {
+        plus.f <<= 1;
+        plus.e--;
+    }
+    plus.f <<= 10;
+    plus.e -= 10;
+    json__diyfp minus = v.f == (1ull << 52) ? (json__diyfp){(v.f << 2) - 1, v.e - 2}
+                                           : (json__diyfp){(v.f << 1) - 1, v.e - 1};
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+
+    double dk = (-61 - plus.e) * 0.30102999566398114 + 347;
+    int ik = (int)dk;
+    if (dk - ik > 0.0)
+        ik++;
+    unsigned index = (unsigned)((ik >> 3) + 1);
+    *k = -(-348 + (int)(index << 3));
+    json__diyfp c = {json__cached_powers_f[index], json__cached_powers_e[index]};
+
+    json__diyfp w = json__diyfp_mul(json__diyfp_normalize(v), c);
+    json__diyfp wp = json__diyfp_mul(plus, c);
+    json__diyfp wm = json__diyfp_mul(minus, c);
+    wm.f++;
+    wp.f--;
+    int len;
+    json__grisu_digits(w, wp, wp.f - wm.f, buffer, &len, k);
+    return len;
+}
+
+static int json__write_exponent(char *buffer, int e) {
+    int n = 0;
+    if (e < 0) {
+        buffer[n++] = '-';
+        e = -e;
+    }
+    if (e >= 100) {
+        buffer[n++] = (char)('0' + e / 100);
+        e %= 100;
+        buffer[n++] = (char)('0' + e / 10);
+    } else if (e >= 10) {
+        buffer[n++] = (char)('0' + e / 10);
+    }
+    buffer[n++] = (char)('0' + e % 10);
+    return n;
+}
+
+// buffer needs JSON__NUMBER_BUFFER_SIZE bytes; returns the length written.
+// Non-finite values have no JSON spelling and are written as null.
+static int json__format_double(char *buffer, double d) {
+    if (d != d || d - d != 0.0) {
+        memcpy(buffer, "null", 4);
+        return 4;
+    }
+    int n = 0;
+    if (signbit(d)) {
+        buffer[n++] = '-';
+        d = -d;
+    }
+    if (d == 0.0) {
+        buffer[n++] = '0';
+        return n;
+    }
+
+    char *digits = buffer + n;
+    int k;
+    int len = json__grisu2(d, digits, &k);
+    int kk = len + k;
+    if (len <= kk && kk <= 21) {
+        // 1234e7 -> 12340000000
+        for (int i = len; i < kk; i++)
+            digits[i] = '0';
+        return n + kk;
+    }
+    if (0 < kk && kk <= 21) {
+        // 1234e-2 -> 12.34
+        memmove(digits + kk + 1, digits + kk, (size_t)(len - kk));
+        digits[kk] = '.';
+        return n + len + 1;
+    }
+    if (-6 < kk && kk <= 0) {
+        // 1234e-6 -> 0.001234
+        int offset = 2 - kk;
+        memmove(digits + offset, digits, (size_t)len);
+        digits[0] = '0';
+        digits[1] = '.';
+        for (int i = 2; i < offset; i++)
+            digits[i] = '0';
+        return n + len + offset;
+    }
+    if (len == 1) {
+        // 1e30
+        digits[1] = 'e';
+        return n + 2 + json__write_exponent(digits + 2, kk - 1);
+    }
+    // 1234e30 -> 1.234e33
+    memmove(digits + 2, digits + 1, (size_t)(len - 1));
+    digits[1] = '.';
+    digits[len + 1] = 'e';
+    return n + len + 2 + json__write_exponent(digits + len + 2, kk - 1);
+}
+
+static int json__format_integer(char *buffer, int64_t i) {
+    char tmp[20];
+    int n = 0, l = 0;
+    uint64_t u = (uint64_t)i;
+    if (i < 0) {
+        buffer[n++] = '-';
+        u = 0 - u;
+    }
+    do {
+        tmp[l++] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+    while (l)
+        buffer[n++] = tmp[--l];
+    return n;
+}
+
+static int json__format_number(char *buffer, json_value *v) {
+    if (v->flags & JSON__FLAG_INTEGER)
+        return json__format_integer(buffer, v->integer);
+    return json__format_double(buffer, v->number);
+}
+
+static int json__buf_reserve(json_buf *b, size_t n) {
+    if (b->len + n + 1 <= b->cap)
+        return 1;
+    size_t cap = b->cap ? b->cap : 256;
+    while (cap < b->len + n + 1)
+        cap *= 2;
+    char *temp = json__heap_realloc(b->data, cap);
+    if (!temp)
+        return 0;
+    b->data = temp;
+    b->cap = cap;
+    return 1;
+}
+
+static int json__buf_append(json_buf *b, const char *s, size_t n) {
+    if (!json__buf_reserve(b, n))
+        return 0;
+    memcpy(b->data + b->len, s, n);
+    b->len += n;
+    return 1;
+}
+
+static int json__buf_putc(json_buf *b, char c) {
+    if (!json__buf_reserve(b, 1))
+        return 0;
+    b->data[b->len++] = c;
+    return 1;
+}
+
+// Copies the runs that need no escaping whole, so a string without any is
+// one scan and one memcpy.
+static int json__buf_string(json_buf *b, const char *s, size_t n) {
+    static const char hex[] = "0123456789abcdef";
+    const char *end = s + n;
+    if (!json__buf_reserve(b, n + 2))
+        return 0;
+    b->data[b->len++] = '"';
+    while (1) {
+        const char *e = json__scan_escape(s, end);
+        memcpy(b->data + b->len, s, e - s);
+        b->len += e - s;
+        if (e == end)
+            break;
+        // The byte becomes at most six, and the rest and the closing quote
+        // must still fit.
+        if (!json__buf_reserve(b, (size_t)(end - e) + 6))
+            return 0;
+        char *o = b->data + b->len;
+        unsigned char c = (unsigned char)*e;
+        o[0] = '\\';
+        switch (c) {
+            case '"': o[1] = '"'; b->len += 2; break;
+            case '\\': o[1] = '\\'; b->len += 2; break;
+            case '\b': o[1] = 'b'; b->len += 2; break;
+            case '\f': o[1] = 'f'; b->len += 2; break;
+            case '\n': o[1] = 'n'; b->len += 2; break;
+            case '\r': o[1] = 'r'; b->len += 2; break;
+            case '\t': o[1] = 't'; b->len += 2; break;
+            default:
+                memcpy(o + 1, "u00", 3);
+                o[4] = hex[c >> 4];
+                o[5] = hex[c & 0xF];
+                b->len += 6;
+                break;
+        }
+        s = e + 1;
+    }
+    b->data[b->len++] = '"';
+    return 1;
+}
+
+static int json__buf_number(json_buf *b, json_value *v) {
+    if (!json__buf_reserve(b, JSON__NUMBER_BUFFER_SIZE))
+        return 0;
+    b->len += json__format_number(b->data + b->len, v);
+    return 1;
+}
+
+static int json__writer_flush(json_writer *w) {
+    if (!w->write || !w->buf.len)
+        return 1;
+    if (!w->write(w->user, w->buf.data, w->buf.len)) {
+        w->error = JSON_ERROR_IO;
+        return 0;
+    }
+    w->buf.len = 0;
+    return 1;
+}
+
+// Called between tokens: a sink drains the buffer once it fills up, while
+// a writer without one keeps everything.
+static int json__writer_check(json_writer *w) {
+    if (w->write && w->buf.len >= JSON_WRITER_BUFFER_SIZE)
+        return json__writer_flush(w);
+    return 1;
+}
+
+static int json__writer_indent(json_writer *w, int level) {
+    size_t n = (size_t)level * (size_t)w->indent;
+    if (!json__buf_reserve(&w->buf, n + 1))
+        return 0;
+    w->buf.data[w->buf.len++] = '\n';
+    memset(w->buf.data + w->buf.len, ' ', n);
+    w->buf.len += n;
+    return 1;
+}
+
+static int json__write_scalar(json_buf *b, json_value *v) {
+    switch (v->type) {
+        case JSON_STRING:
+            return json__buf_string(b, v->string.data, v->string.len);
+        case JSON_NUMBER:
+            return json__buf_number(b, v);
+        case JSON_BOOL:
+            return v->boolean ? json__buf_append(b, "true", 4) : json__buf_append(b, "false", 5);
+        case JSON_NULL:
+            return json__buf_append(b, "null", 4);
+        default:
+            return 1;
+    }
+}
+
+typedef struct {
+    json_value *container;
+    size_t next;
+} json__write_frame;
+
+// Pretty output puts every member and element on its own line, indented
+// w->indent spaces per level. Open containers are kept on an explicit
+// stack, so any depth of tree can be written.
+static int json__write(json_writer *w, json_value *v, int pretty) {
+    json__write_frame small[32];
+    json__write_frame *stack = small;
+    size_t depth = 0;
+    size_t cap = sizeof small / sizeof *small;
+    json_buf *b = &w->buf;
+
+    while (1) {
+        if (v) {
+            if (!json__writer_check(w))
+                goto fail;
+            json__materialize(v);
+            if (v->type == JSON_OBJECT || v->type == JSON_ARRAY) {
+                if (!json__buf_putc(b, v->type == JSON_OBJECT ? '{' : '['))
+                    goto fail;
+                if (depth == cap) {
+                    json__write_frame *temp = stack == small ? json__heap_alloc(2 * cap * sizeof *temp)
+                                                             : json__heap_realloc(stack, 2 * cap * sizeof *temp);
+                    if (!temp)
+                        goto fail;
+                    if (stack == small)
+                        memcpy(temp, small, sizeof small);
+                    stack = temp;
+                    cap *= 2;
+                }
+                stack[depth++] = (json__write_frame){v, 0};
+            } else if (!json__write_scalar(b, v)) {
+                goto fail;
+            }
+        }
+
+        // Write the separator and key before the next child, or close every
+        // container that has run out of them.
+        v = NULL;
+        while (depth) {
+            json__write_frame *f = &stack[depth - 1];
+            json_value *c = f->container;
+            size_t count = c->type == JSON_OBJECT ? c->object.count : c->array.count;
+            if (f->next < count) {
+                if ((f->next && !json__buf_putc(b, ',')) || (pretty && !json__writer_indent(w, (int)depth)))
+                    goto fail;
+                if (c->type == JSON_OBJECT) {
+                    kvp *e = &c->object.items[f->next];
+                    if (!json__buf_string(b, e->key, e->key_len) ||
+                        !json__buf_putc(b, ':') ||
+                        (pretty && !json__buf_putc(b, ' ')))
+                        goto fail;
+                    v = e->val;
+                } else {
+                    v = c->array.items[f->next];
+                }
+                f->next++;
+                break;
+            }
+            depth--;
+            if ((pretty && !json__writer_indent(w, (int)depth)) ||
+                !json__buf_putc(b, c->type == JSON_OBJECT ? '}' : ']'))
+                goto fail;
+        }
+        if (!depth && !v)
+            break;
+    }
+    if (stack != small)
+        json__heap_free(stack);
+    return 1;
+
+fail:
+    if (stack != small)
+        json__heap_free(stack);
+    return 0;
+}
+
+static int json__write_file(void *user, const char *data, size_t len) {
+    return fwrite(data, 1, len, (FILE *)user) == len;
+}
+
+static int json__write_fd(void *user, const char *data, size_t len) {
+    int fd = (int)(intptr_t)user;
+    while (len) {
+#ifdef _WIN32
+        int n = _write(fd, data, len > INT32_MAX ? INT32_MAX : (unsigned)len);
+#else
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+#endif
+        if (n <= 0)
+            return 0;
+        data += n;
+        len -= (size_t)n;
+    }
+    return 1;
+}
+
+void json_writer_init(json_writer *w, json_write_fn write, void *user) {
+    w->buf = (json_buf){NULL, 0, 0};
+    w->write = write;
+    w->user = user;
+    w->indent = 4;
+    w->error = JSON_ERROR_NONE;
+}
+
+void json_writer_init_file(json_writer *w, FILE *stream) {
+    json_writer_init(w, json__write_file, stream);
+}
+
+void json_writer_init_fd(json_writer *w, int fd) {
+    json_writer_init(w, json__write_fd, (void *)(intptr_t)fd);
+}
+
+static int json__writer_value(json_writer *w, json_value *v, int pretty) {
+    if (w->error != JSON_ERROR_NONE)
+        return 0;
+    size_t start = w->buf.len;
+    JSON__STATS_CLOCK(t);
+    if (!json__write(w, v, pretty)) {
+        if (w->error == JSON_ERROR_NONE) {
+            w->error = JSON_ERROR_MEMORY;
+            w->buf.len = start;
+        }
+        return 0;
+    }
+    JSON__STATS_ADD(writes, 1);
+    JSON__STATS_ADD(bytes_written, w->buf.len - start);
+    JSON__STATS_ELAPSED(write_ns, t);
+    return json__writer_check(w);
+}
+
+int json_write(json_writer *w, json_value *v) {
+    return json__writer_value(w, v, 0);
+}
+
+int json_write_pretty(json_writer *w, json_value *v) {
+    return json__writer_value(w, v, 1);
+}
+
+int json_write_raw(json_writer *w, const char *data, size_t len) {
+    if (w->error != JSON_ERROR_NONE)
+        return 0;
+    if (!json__buf_append(&w->buf, data, len)) {
+        w->error = JSON_ERROR_MEMORY;
+        return 0;
+    }
+    return json__writer_check(w);
+}
+
+int json_writer_flush(json_writer *w) {
+    if (w->error != JSON_ERROR_NONE)
+        return 0;
+    return json__writer_flush(w);
+}
+
+void json_writer_free(json_writer *w) {
+    json_buf_free(&w->buf);
+}
+
+void json_print(FILE *stream, json_value *v) {
+    json_writer w;
+    json_writer_init_file(&w, stream);
+    json_write(&w, v);
+    json_writer_flush(&w);
+    json_writer_free(&w);
+}
+
+void json_pretty_print(FILE* stream, json_value *v) {
+    json_writer w;
+    json_writer_init_file(&w, stream);
+    json_write_pretty(&w, v);
+    json_write_raw(&w, "\n", 1);
+    json_writer_flush(&w);
+    json_writer_free(&w);
+}
+
+char *json_to_buffer(json_buf *b, json_value *v) {
+    if (!v || !json__buf_reserve(b, 0))
+        return NULL;
+
+    json_writer w;
+    json_writer_init(&w, NULL, NULL);
+    w.buf = *b;
+    size_t start = b->len;
+    JSON__STATS_CLOCK(t);
+    int ok = json__write(&w, v, 0);
+    *b = w.buf;
+    if (!ok)
+        b->len = start;
+    JSON__STATS_ADD(writes, 1);
+    JSON__STATS_ADD(bytes_written, b->len - start);
+    JSON__STATS_ELAPSED(write_ns, t);
+    b->data[b->len] = '\0';
+    return ok ? b->data + start : NULL;
+}
+
+void json_buf_reset(json_buf *b) {
+    b->len = 0;
+    if (b->data)
+        b->data[0] = '\0';
+}
+
+void json_buf_free(json_buf *b) {
+    json__heap_free(b->data);
+    b->data = NULL;
+    b->len = 0;
+    b->cap = 0;
+}
+
+char* json_to_string(json_value *v) {
+    json_buf b = {0};
+    if (!json_to_buffer(&b, v)) {
+        json_buf_free(&b);
+        return NULL;
+    }
+    return b.data;
+}
+
+#define JSON__BINARY_MAGIC 0x424E534Au
+#define JSON__BINARY_VERSION 1
+#define JSON__BINARY_HEADER_SIZE 16
+
+enum {
+    JSON__BINARY_NULL,
+    JSON__BINARY_FALSE,
+    JSON__BINARY_TRUE,
+    JSON__BINARY_INTEGER,
+    JSON__BINARY_DOUBLE,
+    JSON__BINARY_STRING,
+    JSON__BINARY_ARRAY,
+    JSON__BINARY_OBJECT
+};
+
+typedef struct {
+    json_value *container;
+    size_t at;
+    size_t next;
+    size_t end;
+    char *key;
+    size_t key_len;
+    int key_borrowed;
+} json__binary_frame;
+
+static size_t json__binary_pad(size_t n) {
+    return (n + 7) & ~(size_t)7;
+}
+
+static uint64_t json__binary_load(const char *data, size_t at) {
+    uint64_t x;
+    memcpy(&x, data + at, sizeof x);
+    return x;
+}
+
+// Checks the string at pos against limit, returning its size in the
+// encoding and its length in *len, or 0 if it is not a string that fits.
+static size_t json__binary_string_size(const char *data, size_t pos, size_t limit, size_t *len) {
+    if (limit - pos < 16 || (json__binary_load(data, pos) & 0xFF) != JSON__BINARY_STRING)
+        return 0;
+    uint64_t payload = json__binary_load(data, pos) >> 8;
+    if (payload >= limit - pos - 8)
+        return 0;
+    size_t size = 8 + json__binary_pad((size_t)payload + 1);
+    if (size > limit - pos || data[pos + 8 + payload] != '\0')
+        return 0;
+    *len = (size_t)payload;
+    return size;
+}
+
+static void json__binary_store(json_buf *b, size_t start, size_t at, uint64_t x) {
+    memcpy(b->data + start + at, &x, sizeof x);
+}
+
+// Appends n zero bytes and returns their offset, or 0, which no value
+// starts at, when out of memory.
+static size_t json__binary_grow(json_buf *b, size_t start, size_t n) {
+    if (!json__buf_reserve(b, n))
+        return 0;
+    memset(b->data + b->len, 0, n);
+    b->len += n;
+    return b->len - n - start;
+}
+
+static int json__binary_string(json_buf *b, size_t start, const char *s, size_t len) {
+    size_t at = json__binary_grow(b, start, 8 + json__binary_pad(len + 1));
+    if (!at)
+        return 0;
+    json__binary_store(b, start, at, JSON__BINARY_STRING | (uint64_t)len << 8);
+    memcpy(b->data + start + at + 8, s, len);
+    return 1;
+}
+
+int json_to_binary(json_buf *b, json_value *v) {
+    if (!v)
+        return 0;
+
+    json__binary_frame small[32];
+    json__binary_frame *stack = small;
+    size_t depth = 0;
+    size_t cap = sizeof small / sizeof *small;
+    size_t start = b->len;
+    if (!json__buf_reserve(b, JSON__BINARY_HEADER_SIZE))
+        return 0;
+    uint32_t header[2] = {JSON__BINARY_MAGIC, JSON__BINARY_VERSION};
+    memcpy(b->data + start, header, sizeof header);
+    b->len += JSON__BINARY_HEADER_SIZE;
+
+    // A NULL child is written as null, so pending rather than v says
+    // whether a value is due.
+    int pending = 1;
+    while (pending) {
+        if (v)
+            json__materialize(v);
+        size_t at;
+        json_type t = v ? v->type : JSON_NULL;
+        if (t == JSON_OBJECT || t == JSON_ARRAY) {
+            size_t count = t == JSON_OBJECT ? v->object.count : v->array.count;
+            if (!(at = json__binary_grow(b, start, 16 + count * (t == JSON_OBJECT ? 24 : 8))))
+                goto fail;
+            json__binary_store(b, start, at, (t == JSON_OBJECT ? JSON__BINARY_OBJECT : JSON__BINARY_ARRAY) |
+                                             (uint64_t)count << 8);
+            if (depth == cap) {
+                json__binary_frame *temp = stack == small ? json__heap_alloc(2 * cap * sizeof *temp)
+                                                          : json__heap_realloc(stack, 2 * cap * sizeof *temp);
+                if (!temp)
+                    goto fail;
+                if (stack == small)
+                    memcpy(temp, small, sizeof small);
+                stack = temp;
+                cap *= 2;
+            }
+            stack[depth++] = (json__binary_frame){v, at, 0, 0, NULL, 0, 0};
+        } else if (t == JSON_STRING) {
+            if (!json__binary_string(b, start, v->string.data, v->string.len))
+                goto fail;
+        } else if (t == JSON_NUMBER) {
+            if (!(at = json__binary_grow(b, start, 16)))
+                goto fail;
+            uint64_t bits;
+            memcpy(&bits, v->flags & JSON__FLAG_INTEGER ? (void *)&v->integer : (void *)&v->number, sizeof bits);
+            json__binary_store(b, start, at, v->flags & JSON__FLAG_INTEGER ? JSON__BINARY_INTEGER : JSON__BINARY_DOUBLE);
+            json__binary_store(b, start, at + 8, bits);
+        } else {
+            if (!(at = json__binary_grow(b, start, 8)))
+                goto fail;
+            json__binary_store(b, start, at, t == JSON_NULL ? JSON__BINARY_NULL
+                                             : v->boolean ? JSON__BINARY_TRUE : JSON__BINARY_FALSE);
+        }
+
+        // Fill in the table entry of the next child, writing its key first,
+        // or the end of every container that has run out of them.
+        pending = 0;
+        while (depth) {
+            json__binary_frame *f = &stack[depth - 1];
+            json_value *c = f->container;
+            size_t here = b->len - start;
+            if (c->type == JSON_OBJECT && f->next < c->object.count) {
+                kvp *e = &c->object.items[f->next];
+                size_t entry = f->at + 16 + f->next * 24;
+                json__binary_store(b, start, entry, here);
+                if (!json__binary_string(b, start, e->key, e->key_len))
+                    goto fail;
+                json__binary_store(b, start, entry + 8, b->len - start);
+                json__binary_store(b, start, entry + 16, e->key_len | (uint64_t)json__hash(e->key, e->key_len) << 32);
+                v = e->val;
+            } else if (c->type == JSON_ARRAY && f->next < c->array.count) {
+                json__binary_store(b, start, f->at + 16 + f->next * 8, here);
+                v = c->array.items[f->next];
+            } else {
+                json__binary_store(b, start, f->at + 8, here);
+                depth--;
+                continue;
+            }
+            f->next++;
+            pending = 1;
+            break;
+        }
+    }
+    json__binary_store(b, start, 8, b->len - start);
+    if (stack != small)
+        json__heap_free(stack);
+    return 1;
+
+fail:
+    b->len = start;
+    if (stack != small)
+        json__heap_free(stack);
+    return 0;
+}
+
+// Decodes the value at *at, which must end by limit, moving *at past it.
+// Containers come back empty with room for their children and their table
+// and end checked; strings are copied unless borrowed is set.
+static json_value *json__binary_value(json_parser *p, const char *data, size_t *at, size_t limit, int borrowed) {
+    size_t pos = *at;
+    if (limit - pos < 8) {
+        p->error = JSON_ERROR_SYNTAX;
+        return NULL;
+    }
+    uint64_t head = json__binary_load(data, pos);
+    uint64_t payload = head >> 8;
+    json_value *v = NULL;
+    size_t size = 8;
+    switch (head & 0xFF) {
+        case JSON__BINARY_NULL:
+            v = p->arena ? &json__null : json__new_value(NULL, JSON_NULL);
+            break;
+        case JSON__BINARY_FALSE:
+        case JSON__BINARY_TRUE:
+            if (p->arena) {
+                v = (head & 0xFF) == JSON__BINARY_TRUE ? &json__true : &json__false;
+            } else if ((v = json__new_value(NULL, JSON_BOOL))) {
+                v->boolean = (head & 0xFF) == JSON__BINARY_TRUE;
+            }
+            break;
+        case JSON__BINARY_INTEGER:
+        case JSON__BINARY_DOUBLE:
+            size = 16;
+            if (limit - pos < size)
+                goto bad;
+            if ((v = json__new_value(p->arena, JSON_NUMBER))) {
+                uint64_t bits = json__binary_load(data, pos + 8);
+                if ((head & 0xFF) == JSON__BINARY_INTEGER) {
+                    v->flags |= JSON__FLAG_INTEGER;
+                    memcpy(&v->integer, &bits, sizeof bits);
+                } else {
+                    memcpy(&v->number, &bits, sizeof bits);
+                }
+            }
+            break;
+        case JSON__BINARY_STRING: {
+            size_t len;
+            if (!(size = json__binary_string_size(data, pos, limit, &len)))
+                goto bad;
+            char *s = (char *)data + pos + 8;
+            if (!borrowed) {
+                if (!(s = json__alloc(p->arena, len + 1)))
+                    break;
+                memcpy(s, data + pos + 8, len + 1);
+            }
+            if (!(v = json__new_value(p->arena, JSON_STRING))) {
+                if (!borrowed)
+                    json__free(p->arena, s);
+                break;
+            }
+            if (borrowed)
+                v->flags |= JSON__FLAG_BORROWED;
+            v->string.data = s;
+            v->string.len = len;
+            break;
+        }
+        case JSON__BINARY_ARRAY:
+        case JSON__BINARY_OBJECT: {
+            int object = (head & 0xFF) == JSON__BINARY_OBJECT;
+            size_t width = object ? 24 : 8;
+            if (limit - pos < 16 || payload > (limit - pos - 16) / width || payload > UINT32_MAX / 2)
+                goto bad;
+            size = 16 + (size_t)payload * width;
+            uint64_t end = json__binary_load(data, pos + 8);
+            if (end < pos + size || end > limit)
+                goto bad;
+            if (!(v = json__new_value(p->arena, object ? JSON_OBJECT : JSON_ARRAY)))
+                break;
+            if (object && payload) {
+                if (!(v->object.items = json__alloc(p->arena, (size_t)payload * sizeof(kvp))))
+                    goto oom;
+                v->object.cap = (uint32_t)payload;
+            } else if (payload == 1) {
+                v->array.items = v->array.small;
+                v->array.cap = 1;
+            } else if (payload) {
+                if (!(v->array.items = json__alloc(p->arena, (size_t)payload * sizeof(json_value *))))
+                    goto oom;
+                v->array.cap = (uint32_t)payload;
+            }
+            break;
+        }
+        default:
+            goto bad;
+    }
+    if (!v) {
+        p->error = JSON_ERROR_MEMORY;
+        return NULL;
+    }
+    *at = pos + size;
+    return v;
+
+oom:
+    p->error = JSON_ERROR_MEMORY;
+    json_free(&v);
+    return NULL;
+
+bad:
+    p->error = JSON_ERROR_SYNTAX;
+    return NULL;
+}
+
+// Returns the size the header of an encoding claims, or 0 if the header is
+// not ours or claims more than len.
+static size_t json__binary_size(const char *data, size_t len) {
+    uint32_t header[2];
+    if (len < JSON__BINARY_HEADER_SIZE)
+        return 0;
+    memcpy(header, data, sizeof header);
+    uint64_t size = json__binary_load(data, 8);
+    if (header[0] != JSON__BINARY_MAGIC || header[1] != JSON__BINARY_VERSION || size > len || size % 8 ||
+        size < JSON__BINARY_HEADER_SIZE + 8)
+        return 0;
+    return (size_t)size;
+}
+
+json_value *json_from_binary_ex(json_parser *p, const void *data, size_t len) {
+    const char *d = data;
+    p->cur = d;
+    p->end = d + len;
+    p->error = JSON_ERROR_NONE;
+    size_t size = json__binary_size(d, len);
+    if (!size) {
+        p->error = JSON_ERROR_SYNTAX;
+        return NULL;
+    }
+
+    json__binary_frame small[32];
+    json__binary_frame *stack = small;
+    size_t depth = 0;
+    size_t cap = sizeof small / sizeof *small;
+    size_t max_depth = json__max_depth(p);
+    int borrowed = (p->flags & JSON_PARSE_STRING_VIEWS) != 0;
+    size_t pos = JSON__BINARY_HEADER_SIZE;
+    size_t limit = size;
+    json_value *root = NULL;
+
+    while (1) {
+        size_t at = pos;
+        json_value *v = json__binary_value(p, d, &pos, limit, borrowed);
+        if (!v)
+            goto fail;
+
+        if (!depth) {
+            root = v;
+        } else {
+            json__binary_frame *f = &stack[depth - 1];
+            if (f->container->type == JSON_ARRAY) {
+                f->container->array.items[f->container->array.count++] = v;
+            } else {
+                struct json_object *o = &f->container->object;
+                o->items[o->count++] = (kvp){f->key, v, (uint32_t)f->key_len, (uint32_t)f->key_borrowed, 0};
+                f->key = NULL;
+            }
+        }
+
+        if (v->type == JSON_OBJECT || v->type == JSON_ARRAY) {
+            if (depth == max_depth) {
+                p->error = JSON_ERROR_DEPTH;
+                goto fail;
+            }
+            if (depth == cap) {
+                json__binary_frame *temp = stack == small ? json__heap_alloc(2 * cap * sizeof *temp)
+                                                          : json__heap_realloc(stack, 2 * cap * sizeof *temp);
+                if (!temp) {
+                    p->error = JSON_ERROR_MEMORY;
+                    goto fail;
+                }
+                if (stack == small)
+                    memcpy(temp, small, sizeof small);
+                stack = temp;
+                cap *= 2;
+            }
+            stack[depth++] = (json__binary_frame){v, at, 0, (size_t)json__binary_load(d, at + 8), NULL, 0, 0};
+        }
+
+        // Children must follow their table in order and fill the container
+        // to its end, so every byte belongs to exactly one value and a
+        // crafted buffer cannot make the tree share or loop.
+        while (depth) {
+            json__binary_frame *f = &stack[depth - 1];
+            json_value *c = f->container;
+            uint32_t n = c->type == JSON_OBJECT ? c->object.cap : c->array.cap;
+            if (f->next == n) {
+                if (pos != f->end)
+                    goto bad;
+                if (c->type == JSON_OBJECT && c->object.count >= JSON_OBJECT_INDEX_THRESHOLD)
+                    json__object_build_index(p->arena, &c->object);
+                depth--;
+                continue;
+            }
+            if (c->type == JSON_ARRAY) {
+                if (json__binary_load(d, f->at + 16 + f->next * 8) != pos)
+                    goto bad;
+            } else {
+                size_t entry = f->at + 16 + f->next * 24;
+                size_t key_len;
+                size_t key_size = json__binary_string_size(d, pos, f->end, &key_len);
+                if (json__binary_load(d, entry) != pos || !key_size || key_len > INT32_MAX ||
+                    json__binary_load(d, entry + 8) != pos + key_size)
+                    goto bad;
+                f->key = (char *)d + pos + 8;
+                if (!borrowed) {
+                    if (!(f->key = json__alloc(p->arena, key_len + 1))) {
+                        p->error = JSON_ERROR_MEMORY;
+                        goto fail;
+                    }
+                    memcpy(f->key, d + pos + 8, key_len + 1);
+                }
+                f->key_len = key_len;
+                f->key_borrowed = borrowed;
+                pos += key_size;
+            }
+            f->next++;
+            limit = f->end;
+            break;
+        }
+        if (!depth)
+            break;
+    }
+    if (pos != size)
+        goto bad;
+    if (stack != small)
+        json__heap_free(stack);
+    return root;
+
+bad:
+    p->error = JSON_ERROR_SYNTAX;
+fail:
+    p->cur = d + pos;
+    if (depth && stack[depth - 1].key && !stack[depth - 1].key_borrowed)
+        json__free(p->arena, stack[depth - 1].key);
+    json_free(&root);
+    if (stack != small)
+        json__heap_free(stack);
+    return NULL;
+}
+
+json_value *json_from_binary(const void *data, size_t len) {
+    json_parser p = {0};
+    return json_from_binary_ex(&p, data, len);
+}
+
+json_document *json_document_from_binary_ex(json_parser *p, const void *data, size_t len) {
+    json_document *doc = json__document_new(p->allocator);
+    if (!doc) {
+        p->error = JSON_ERROR_MEMORY;
+        return NULL;
+    }
+    p->arena = &doc->arena;
+    doc->root = json_from_binary_ex(p, data, len);
+    p->arena = NULL;
+    if (!doc->root)
+        json_document_free(&doc);
+    return doc;
+}
+
+json_document *json_document_from_binary(const void *data, size_t len) {
+    json_parser p = {0};
+    return json_document_from_binary_ex(&p, data, len);
+}
+
+struct json_snapshot {
+    const char *data;
+    size_t size;
+    json__file file;
+};
+
+int json_snapshot_write(const char *path, json_value *v) {
+    json_buf b = {0};
+    if (!json_to_binary(&b, v)) {
+        json_buf_free(&b);
+        return 0;
+    }
+
+    size_t l = strlen(path);
+    char *temp = json__heap_alloc(l + 5);
+    if (!temp) {
+        json_buf_free(&b);
+        return 0;
+    }
+    memcpy(temp, path, l);
+    memcpy(temp + l, ".tmp", 5);
+    FILE *f = fopen(temp, "wb");
+    if (!f) {
+        fprintf(stderr, "error, failed to open %s: %s:%d\n", temp, __FILE__, __LINE__);
+        json__heap_free(temp);
+        json_buf_free(&b);
+        return 0;
+    }
+    int ok = fwrite(b.data, 1, b.len, f) == b.len;
+    ok = fclose(f) == 0 && ok;
+    if (ok && rename(temp, path) != 0) {
+        fprintf(stderr, "error, failed to rename %s to %s\n", temp, path);
+        ok = 0;
+    }
+    if (!ok)
+        remove(temp);
+    json__heap_free(temp);
+    json_buf_free(&b);
+    return ok;
+}
+
+json_snapshot *json_snapshot_from_buffer(const void *data, size_t len) {
+    size_t size = json__binary_size(data, len);
+    if (!size)
+        return NULL;
+    json_snapshot *s = json__heap_alloc(sizeof *s);
+    if (!s)
+        return NULL;
+    s->data = data;
+    s->size = size;
+    s->file = (json__file){NULL, 0, 0};
+    return s;
+}
+
+json_snapshot *json_snapshot_open(const char *path) {
+    json__file f;
+    if (!json__file_open(&f, path))
+        return NULL;
+    json_snapshot *s = json_snapshot_from_buffer(f.data, f.size);
+    if (!s) {
+        fprintf(stderr, "error, %s is not a snapshot\n", path);
+        json__file_close(&f);
+        return NULL;
+    }
+#if defined(JSON__HAVE_MMAP) && defined(MADV_RANDOM)
+    // Lookups jump around the file, so read-ahead would mostly be wasted.
+    if (f.mapped)
+        madvise((void *)f.data, f.size, MADV_RANDOM);
+#endif
+    s->file = f;
+    return s;
+}
+
+void json_snapshot_close(json_snapshot **s) {
+    if (!s || !*s)
+        return;
+
+    if ((*s)->file.data)
+        json__file_close(&(*s)->file);
+    json__heap_free(*s);
+    *s = NULL;
+}
+
+// Returns the tag of the value at v, or -1 when v cannot be one.
+static int json__snapshot_tag(json_snapshot *s, size_t v) {
+    if (!s || v % 8 || v < JSON__BINARY_HEADER_SIZE || v > s->size - 8)
+        return -1;
+    return (int)(json__binary_load(s->data, v) & 0xFF);
+}
+
+// The child count of a container whose table fits, 0 otherwise.
+static size_t json__snapshot_count(json_snapshot *s, size_t v, int tag) {
+    size_t width = tag == JSON__BINARY_OBJECT ? 24 : 8;
+    if ((tag != JSON__BINARY_OBJECT && tag != JSON__BINARY_ARRAY) || s->size - v < 16)
+        return 0;
+    uint64_t count = json__binary_load(s->data, v) >> 8;
+    return count > (s->size - v - 16) / width ? 0 : (size_t)count;
+}
+
+static size_t json__snapshot_checked(json_snapshot *s, uint64_t v) {
+    return v < s->size && json__snapshot_tag(s, (size_t)v) >= 0 ? (size_t)v : JSON_SNAPSHOT_NONE;
+}
+
+size_t json_snapshot_root(json_snapshot *s) {
+    return json__snapshot_tag(s, JSON__BINARY_HEADER_SIZE) >= 0 ? JSON__BINARY_HEADER_SIZE : JSON_SNAPSHOT_NONE;
+}
+
+size_t json_snapshot_count(json_snapshot *s, size_t v) {
+    int tag = json__snapshot_tag(s, v);
+    return tag < 0 ? 0 : json__snapshot_count(s, v, tag);
+}
+
+size_t json_snapshot_get(json_snapshot *s, size_t obj, const char *key) {
+    int tag = json__snapshot_tag(s, obj);
+    if (tag != JSON__BINARY_OBJECT)
+        return JSON_SNAPSHOT_NONE;
+
+    size_t l = strlen(key);
+    uint64_t want = l | (uint64_t)json__hash(key, l) << 32;
+    size_t count = json__snapshot_count(s, obj, tag);
+    for (size_t i = 0; i < count; i++) {
+        size_t entry = obj + 16 + i * 24;
+        if (json__binary_load(s->data, entry + 16) != want)
+            continue;
+        uint64_t k = json__binary_load(s->data, entry);
+        size_t kl;
+        if (k < s->size && k % 8 == 0 && json__binary_string_size(s->data, (size_t)k, s->size, &kl) && kl == l &&
+            memcmp(s->data + k + 8, key, l) == 0)
+            return json__snapshot_checked(s, json__binary_load(s->data, entry + 8));
+    }
+    return JSON_SNAPSHOT_NONE;
+}
+
+size_t json_snapshot_geti(json_snapshot *s, size_t v, size_t index) {
+    int tag = json__snapshot_tag(s, v);
+    if (tag < 0 || index >= json__snapshot_count(s, v, tag))
+        return JSON_SNAPSHOT_NONE;
+    if (tag == JSON__BINARY_OBJECT)
+        return json__snapshot_checked(s, json__binary_load(s->data, v + 16 + index * 24 + 8));
+    return json__snapshot_checked(s, json__binary_load(s->data, v + 16 + index * 8));
+}
+
+size_t json_snapshot_key(json_snapshot *s, size_t obj, size_t index) {
+    int tag = json__snapshot_tag(s, obj);
+    if (tag != JSON__BINARY_OBJECT || index >= json__snapshot_count(s, obj, tag))
+        return JSON_SNAPSHOT_NONE;
+    return json__snapshot_checked(s, json__binary_load(s->data, obj + 16 + index * 24));
+}
+
+json_type json_snapshot_type(json_snapshot *s, size_t v) {
+    switch (json__snapshot_tag(s, v)) {
+        case JSON__BINARY_OBJECT: return JSON_OBJECT;
+        case JSON__BINARY_ARRAY: return JSON_ARRAY;
+        case JSON__BINARY_STRING: return JSON_STRING;
+        case JSON__BINARY_INTEGER:
+        case JSON__BINARY_DOUBLE: return JSON_NUMBER;
+        case JSON__BINARY_TRUE:
+        case JSON__BINARY_FALSE: return JSON_BOOL;
+        default: return JSON_NULL;
+    }
+}
+
+const char *json_snapshot_query_string(json_snapshot *s, size_t v) {
+    size_t l;
+    if (json__snapshot_tag(s, v) < 0 || !json__binary_string_size(s->data, v, s->size, &l))
+        return NULL;
+    return s->data + v + 8;
+}
+
+size_t json_snapshot_query_string_len(json_snapshot *s, size_t v) {
+    size_t l;
+    if (json__snapshot_tag(s, v) < 0 || !json__binary_string_size(s->data, v, s->size, &l))
+        return 0;
+    return l;
+}
+
+// The bits of a number, with *tag saying which kind, or 0 for other values.
+static uint64_t json__snapshot_number(json_snapshot *s, size_t v, int *tag) {
+    *tag = json__snapshot_tag(s, v);
+    if ((*tag != JSON__BINARY_INTEGER && *tag != JSON__BINARY_DOUBLE) || s->size - v < 16)
+        return 0;
+    return json__binary_load(s->data, v + 8);
+}
+
+double json_snapshot_query_number(json_snapshot *s, size_t v) {
+    int tag;
+    uint64_t bits = json__snapshot_number(s, v, &tag);
+    if (tag == JSON__BINARY_INTEGER)
+        return (double)(int64_t)bits;
+    double d;
+    memcpy(&d, &bits, sizeof d);
+    return d;
+}
+
+int64_t json_snapshot_query_integer(json_snapshot *s, size_t v) {
+    int tag;
+    uint64_t bits = json__snapshot_number(s, v, &tag);
+    if (tag == JSON__BINARY_INTEGER)
+        return (int64_t)bits;
+    double d;
+    memcpy(&d, &bits, sizeof d);
+    return json__double_to_integer(d);
+}
+
+int json_snapshot_query_is_integer(json_snapshot *s, size_t v) {
+    return json__snapshot_tag(s, v) == JSON__BINARY_INTEGER;
+}
+
+int json_snapshot_query_boolean(json_snapshot *s, size_t v) {
+    return json__snapshot_tag(s, v) == JSON__BINARY_TRUE;
+}
+
+enum {
+    JSON__STREAM_NONE,
+    JSON__STREAM_STRING,
+    JSON__STREAM_BARE
+};
+
+typedef struct {
+    json_value *container;
+    char *key;
+    size_t key_len;
+} json__stream_frame;
+
+struct json_stream {
+    json_value *root;
+    json__stream_frame *stack;
+    size_t depth;
+    size_t cap;
+    size_t max_depth;
+    json__expect expect;
+    json_error error;
+    // A scalar token cut off by the end of a chunk: its bytes so far, whether
+    // it is a string or a bare number/literal, and whether the chunk ended
+    // right after a backslash inside a string.
+    json_buf pending;
+    int token;
+    int escape;
+};
+
+json_stream *json_stream_new(void) {
+    json_stream *s = json__heap_calloc(1, sizeof *s);
+    return s;
+}
+
+void json_stream_set_max_depth(json_stream *s, size_t max_depth) {
+    s->max_depth = max_depth;
+}
+
+void json_stream_reset(json_stream *s) {
+    for (size_t i = 0; i < s->depth; i++)
+        json__heap_free(s->stack[i].key);
+    s->depth = 0;
+    json_free(&s->root);
+    s->expect = JSON__EXPECT_VALUE;
+    s->error = JSON_ERROR_NONE;
+    s->pending.len = 0;
+    s->token = JSON__STREAM_NONE;
+    s->escape = 0;
+}
+
+void json_stream_free(json_stream **s) {
+    if (!s || !*s)
+        return;
+
+    json_stream_reset(*s);
+    json__heap_free((*s)->stack);
+    json_buf_free(&(*s)->pending);
+    json__heap_free(*s);
+    *s = NULL;
+}
+
+json_error json_stream_error(json_stream *s) {
+    return s->error;
+}
+
+static int json__stream_fail(json_stream *s, json_error error) {
+    if (s->error == JSON_ERROR_NONE)
+        s->error = error;
+    return 0;
+}
+
+static int json__stream_add(json_stream *s, json_value *v) {
+    if (s->depth == 0) {
+        s->root = v;
+        s->expect = JSON__EXPECT_DONE;
+        return 1;
+    }
+    json__stream_frame *f = &s->stack[s->depth - 1];
+    int ok;
+    if (f->container->type == JSON_ARRAY) {
+        ok = json__array_push(NULL, &f->container->array, v);
+    } else {
+        ok = json__object_push(NULL, &f->container->object, (kvp){f->key, v, (uint32_t)f->key_len, 0, 0});
+        if (ok)
+            f->key = NULL;
+    }
+    if (!ok) {
+        json_free(&v);
+        return json__stream_fail(s, JSON_ERROR_MEMORY);
+    }
+    s->expect = JSON__EXPECT_NEXT;
+    return 1;
+}
+
+static int json__stream_open(json_stream *s, json_type t) {
+    if (s->expect != JSON__EXPECT_VALUE && s->expect != JSON__EXPECT_VALUE_OR_CLOSE)
+        return json__stream_fail(s, JSON_ERROR_SYNTAX);
+    if (s->depth == (s->max_depth ? s->max_depth : JSON_DEFAULT_MAX_DEPTH))
+        return json__stream_fail(s, JSON_ERROR_DEPTH);
+    if (s->depth == s->cap) {
+        size_t cap = s->cap ? s->cap * 2 : 16;
+        json__stream_frame *temp = json__heap_realloc(s->stack, cap * sizeof *temp);
+        if (!temp)
+            return json__stream_fail(s, JSON_ERROR_MEMORY);
+        s->stack = temp;
+        s->cap = cap;
+    }
+    json_value *v = json__new_value(NULL, t);
+    if (!v)
+        return json__stream_fail(s, JSON_ERROR_MEMORY);
+    if (!json__stream_add(s, v))
+        return 0;
+    s->stack[s->depth++] = (json__stream_frame){v, NULL, 0};
+    s->expect = t == JSON_OBJECT ? JSON__EXPECT_KEY_OR_CLOSE : JSON__EXPECT_VALUE_OR_CLOSE;
+    return 1;
+}
+
+static int json__stream_close(json_stream *s, json_type t) {
+    int empty = t == JSON_OBJECT ? s->expect == JSON__EXPECT_KEY_OR_CLOSE : s->expect == JSON__EXPECT_VALUE_OR_CLOSE;
+    if (!s->depth || s->stack[s->depth - 1].container->type != t || (!empty && s->expect != JSON__EXPECT_NEXT))
+        return json__stream_fail(s, JSON_ERROR_SYNTAX);
+    json_value *c = s->stack[--s->depth].container;
+    if (t == JSON_OBJECT && c->object.count >= JSON_OBJECT_INDEX_THRESHOLD)
+        json__object_build_index(NULL, &c->object);
+    s->expect = s->depth ? JSON__EXPECT_NEXT : JSON__EXPECT_DONE;
+    return 1;
+}
+
+// Turns one complete scalar token into a key or a value with the batch
+// parser, which must consume exactly the token.
+static int json__stream_scalar(json_stream *s, const char *data, size_t len) {
+    json_parser p = {0};
+    p.cur = data;
+    p.end = data + len;
+    if (s->expect == JSON__EXPECT_KEY || s->expect == JSON__EXPECT_KEY_OR_CLOSE) {
+        size_t l;
+        int borrowed;
+        if (*data != '"')
+            return json__stream_fail(s, JSON_ERROR_SYNTAX);
+        char *k = json__parse_string(&p, &l, &borrowed);
+        if (!k || p.cur != p.end)
+            return json__stream_fail(s, p.error ? p.error : JSON_ERROR_SYNTAX);
+        if (l > INT32_MAX) {
+            json__heap_free(k);
+            return json__stream_fail(s, JSON_ERROR_TOO_LARGE);
+        }
+        s->stack[s->depth - 1].key = k;
+        s->stack[s->depth - 1].key_len = l;
+        s->expect = JSON__EXPECT_COLON;
+        return 1;
+    }
+    if (s->expect != JSON__EXPECT_VALUE && s->expect != JSON__EXPECT_VALUE_OR_CLOSE)
+        return json__stream_fail(s, JSON_ERROR_SYNTAX);
+    json_value *v = json__parse_value(&p);
+    if (!v)
+        return json__stream_fail(s, p.error ? p.error : JSON_ERROR_SYNTAX);
+    if (p.cur != p.end) {
+        json_free(&v);
+        return json__stream_fail(s, JSON_ERROR_SYNTAX);
+    }
+    return json__stream_add(s, v);
+}
+
+// Returns the end of the scalar token that cur starts or continues, or NULL
+// if it runs past end.
+static const char *json__stream_token_end(json_stream *s, const char *cur, const char *end) {
+    if (s->token == JSON__STREAM_STRING) {
+        if (s->escape) {
+            if (cur >= end)
+                return NULL;
+            cur++;
+            s->escape = 0;
+        }
+        while ((cur = json__scan_string(cur, end)) < end) {
+            if (*cur == '"')
+                return cur + 1;
+            if (end - cur < 2) {
+                s->escape = 1;
+                return NULL;
+            }
+            cur += 2;
+        }
+        return NULL;
+    }
+    while (cur < end && !json__is_space(*cur) && !json__is_structural(*cur))
+        cur++;
+    return cur < end ? cur : NULL;
+}
+
+int json_stream_feed(json_stream *s, const char *chunk, size_t len) {
+    if (s->error)
+        return 0;
+
+    const char *cur = chunk;
+    const char *end = chunk + len;
+
+    if (s->token != JSON__STREAM_NONE) {
+        const char *tok_end = json__stream_token_end(s, cur, end);
+        if (!json__buf_append(&s->pending, cur, (tok_end ? tok_end : end) - cur))
+            return json__stream_fail(s, JSON_ERROR_MEMORY);
+        if (!tok_end)
+            return 1;
+        size_t l = s->pending.len;
+        s->token = JSON__STREAM_NONE;
+        s->pending.len = 0;
+        if (!json__stream_scalar(s, s->pending.data, l))
+            return 0;
+        cur = tok_end;
+    }
+
+    while (1) {
+        cur = json__scan_whitespace(cur, end);
+        if (cur >= end)
+            return 1;
+        if (s->expect == JSON__EXPECT_DONE)
+            return json__stream_fail(s, JSON_ERROR_SYNTAX);
+
+        int ok = 1;
+        switch (*cur) {
+            case '{':
+                ok = json__stream_open(s, JSON_OBJECT);
+                break;
+            case '[':
+                ok = json__stream_open(s, JSON_ARRAY);
+                break;
+            case '}':
+                ok = json__stream_close(s, JSON_OBJECT);
+                break;
+            case ']':
+                ok = json__stream_close(s, JSON_ARRAY);
+                break;
+            case ':':
+                if (s->expect != JSON__EXPECT_COLON)
+                    return json__stream_fail(s, JSON_ERROR_SYNTAX);
+                s->expect = JSON__EXPECT_VALUE;
+                break;
+            case ',':
+                if (s->expect != JSON__EXPECT_NEXT)
+                    return json__stream_fail(s, JSON_ERROR_SYNTAX);
+                s->expect = s->stack[s->depth - 1].container->type == JSON_OBJECT ? JSON__EXPECT_KEY : JSON__EXPECT_VALUE;
+                break;
+            default: {
+                s->token = *cur == '"' ? JSON__STREAM_STRING : JSON__STREAM_BARE;
+                const char *start = cur;
+                const char *tok_end = json__stream_token_end(s, s->token == JSON__STREAM_STRING ? cur + 1 : cur, end);
+                if (!tok_end) {
+                    if (!json__buf_append(&s->pending, start, end - start))
+                        return json__stream_fail(s, JSON_ERROR_MEMORY);
+                    return 1;
+                }
+                s->token = JSON__STREAM_NONE;
+                if (!json__stream_scalar(s, start, tok_end - start))
+                    return 0;
+                cur = tok_end;
+                continue;
+            }
+        }
+        if (!ok)
+            return 0;
+        cur++;
+    }
+}
+
+json_value *json_stream_finish(json_stream *s) {
+    if (!s->error && s->token == JSON__STREAM_BARE) {
+        s->token = JSON__STREAM_NONE;
+        json__stream_scalar(s, s->pending.data, s->pending.len);
+    }
+    if (!s->error && (s->token != JSON__STREAM_NONE || s->expect != JSON__EXPECT_DONE))
+        s->error = JSON_ERROR_SYNTAX;
+
+    json_value *root = NULL;
+    if (!s->error) {
+        root = s->root;
+        s->root = NULL;
+    }
+    json_error error = s->error;
+    json_stream_reset(s);
+    s->error = error;
+    return root;
+}
+
+static int json__sax_scalar(json_parser *p, const json_sax *sax, void *user) {
+    int ok = 1;
+    if (json__match_literal(p, "true", 4)) {
+        ok = !sax->boolean || sax->boolean(user, 1);
+    } else if (json__match_literal(p, "false", 5)) {
+        ok = !sax->boolean || sax->boolean(user, 0);
+    } else if (json__match_literal(p, "null", 4)) {
+        ok = !sax->null || sax->null(user);
+    } else if (*p->cur == '-' || isdigit((unsigned char)*p->cur)) {
+        double n;
+        int64_t i;
+        int is_integer;
+        if (!json__parse_number(p, &n, &i, &is_integer))
+            return 0;
+        if (is_integer && sax->integer)
+            ok = sax->integer(user, i);
+        else if (sax->number)
+            ok = sax->number(user, n);
+    } else {
+        p->error = JSON_ERROR_SYNTAX;
+        return 0;
+    }
+    if (!ok) {
+        p->error = JSON_ERROR_ABORTED;
+        return 0;
+    }
+    if (p->cur < p->end && !json__is_space(*p->cur) && !json__is_structural(*p->cur)) {
+        p->error = JSON_ERROR_SYNTAX;
+        return 0;
+    }
+    return 1;
+}
+
+int json_sax_parse_ex(json_parser *p, const json_sax *sax, void *user, const char *data, size_t len) {
+    JSON__STATS_CLOCK(t);
+    p->cur = data;
+    p->end = data + len;
+    p->error = JSON_ERROR_NONE;
+
+    json__expect expect = JSON__EXPECT_VALUE;
+    char *stack = NULL;
+    size_t depth = 0;
+    size_t cap = 0;
+    int ok = 1;
+
+    while (1) {
+        json__skip_whitespace(p);
+        if (p->cur >= p->end)
+            break;
+        if (expect == JSON__EXPECT_DONE)
+            goto fail;
+
+        char c = *p->cur;
+        switch (c) {
+            case '{':
+            case '[':
+                if (expect != JSON__EXPECT_VALUE && expect != JSON__EXPECT_VALUE_OR_CLOSE)
+                    goto fail;
+                if (depth == json__max_depth(p)) {
+                    p->error = JSON_ERROR_DEPTH;
+                    goto fail;
+                }
+                if (depth == cap) {
+                    cap = cap ? cap * 2 : 64;
+                    char *temp = json__heap_realloc(stack, cap);
+                    if (!temp) {
+                        p->error = JSON_ERROR_MEMORY;
+                        goto fail;
+                    }
+                    stack = temp;
+                }
+                stack[depth++] = c;
+                if (c == '{') {
+                    ok = !sax->object_begin || sax->object_begin(user);
+                    expect = JSON__EXPECT_KEY_OR_CLOSE;
+                } else {
+                    ok = !sax->array_begin || sax->array_begin(user);
+                    expect = JSON__EXPECT_VALUE_OR_CLOSE;
+                }
+                p->cur++;
+                break;
+            case '}':
+            case ']': {
+                int empty = expect == (c == '}' ? JSON__EXPECT_KEY_OR_CLOSE : JSON__EXPECT_VALUE_OR_CLOSE);
+                if (!depth || stack[depth - 1] != (c == '}' ? '{' : '[') || (!empty && expect != JSON__EXPECT_NEXT))
+                    goto fail;
+                depth--;
+                if (c == '}')
+                    ok = !sax->object_end || sax->object_end(user);
+                else
+                    ok = !sax->array_end || sax->array_end(user);
+                expect = depth ? JSON__EXPECT_NEXT : JSON__EXPECT_DONE;
+                p->cur++;
+                break;
+            }
+            case ':':
+                if (expect != JSON__EXPECT_COLON)
+                    goto fail;
+                expect = JSON__EXPECT_VALUE;
+                p->cur++;
+                break;
+            case ',':
+                if (expect != JSON__EXPECT_NEXT)
+                    goto fail;
+                expect = stack[depth - 1] == '{' ? JSON__EXPECT_KEY : JSON__EXPECT_VALUE;
+                p->cur++;
+                break;
+            case '"': {
+                const char *s = ++p->cur;
+                int escaped;
+                if (!json__skip_string(p, &escaped))
+                    goto fail;
+                const char *close = p->cur;
+                size_t l = close - s;
+                char small[256];
+                const char *x;
+                if (expect == JSON__EXPECT_KEY || expect == JSON__EXPECT_KEY_OR_CLOSE) {
+                    if (!(x = json__string_view(p, s, &l, escaped, small, sizeof small)))
+                        goto fail;
+                    ok = !sax->key || sax->key(user, x, l);
+                    expect = JSON__EXPECT_COLON;
+                } else if (expect == JSON__EXPECT_VALUE || expect == JSON__EXPECT_VALUE_OR_CLOSE) {
+                    if (!(x = json__string_view(p, s, &l, escaped, small, sizeof small)))
+                        goto fail;
+                    ok = !sax->string || sax->string(user, x, l);
+                    expect = depth ? JSON__EXPECT_NEXT : JSON__EXPECT_DONE;
+                } else {
+                    goto fail;
+                }
+                json__string_view_free(x, s, small);
+                p->cur = close + 1;
+                break;
+            }
+            default:
+                if (expect != JSON__EXPECT_VALUE && expect != JSON__EXPECT_VALUE_OR_CLOSE)
+                    goto fail;
+                if (!json__sax_scalar(p, sax, user))
+                    goto fail;
+                expect = depth ? JSON__EXPECT_NEXT : JSON__EXPECT_DONE;
+                break;
+        }
+        if (!ok) {
+            p->error = JSON_ERROR_ABORTED;
+            goto fail;
+        }
+    }
+    if (expect != JSON__EXPECT_DONE)
+        goto fail;
+    goto done;
+
+fail:
+    if (p->error == JSON_ERROR_NONE)
+        p->error = JSON_ERROR_SYNTAX;
+    ok = 0;
+
+done:
+    json__heap_free(stack);
+    json__parse_position(p, data);
+    JSON__STATS_ADD(parses, 1);
+    JSON__STATS_ADD(bytes_parsed, len);
+    JSON__STATS_ELAPSED(parse_ns, t);
+    return ok;
+}
+
+int json_sax_parse(const json_sax *sax, void *user, const char *data, size_t len) {
+    json_parser p = {0};
+    return json_sax_parse_ex(&p, sax, user, data, len);
+}
+
+int json_sax_parse_file(const json_sax *sax, void *user, const char *path) {
+    json__file f;
+    if (!json__file_open(&f, path))
+        return 0;
+    int ok = json_sax_parse(sax, user, f.data, f.size);
+    json__file_close(&f);
+    return ok;
+}
+
+struct json_lines {
+    json_value **roots;
+    size_t count;
+    size_t failed;
+    json_arena *arenas;
+    size_t arena_count;
+    json__file source;
+};
+
+typedef struct {
+    const char *begin;
+    const char *end;
+    json_value **roots;
+    size_t count;
+    size_t failed;
+    const char *error_at;
+    json_error error;
+    int out_of_memory;
+} json__lines_range;
+
+typedef struct {
+    json__lines_range *ranges;
+    json_arena *arenas;
+    unsigned flags;
+    size_t max_depth;
+} json__lines_job;
+
+static void json__lines_parse_range(void *ctx, size_t worker, size_t task) {
+    json__lines_job *job = ctx;
+    json__lines_range *r = &job->ranges[task];
+    size_t cap = 0;
+    const char *cur = r->begin;
+    while (cur < r->end) {
+        const char *nl = memchr(cur, '\n', r->end - cur);
+        const char *line_end = nl ? nl : r->end;
+        json_parser p = {0};
+        p.arena = &job->arenas[worker];
+        p.flags = job->flags;
+        p.max_depth = job->max_depth;
+        p.cur = cur;
+        p.end = line_end;
+        json__skip_whitespace(&p);
+        if (p.cur < p.end) {
+            json_value *v = json_from_buffer_ex(&p, p.cur, line_end - p.cur);
+            if (!v && !r->failed++) {
+                r->error_at = p.cur;
+                r->error = p.error;
+            }
+            if (r->count == cap) {
+                cap = cap ? cap * 2 : 256;
+                json_value **temp = json__heap_realloc(r->roots, cap * sizeof *temp);
+                if (!temp) {
+                    r->out_of_memory = 1;
+                    return;
+                }
+                r->roots = temp;
+            }
+            r->roots[r->count++] = v;
+        }
+        cur = line_end + 1;
+    }
+}
+
+json_lines *json_lines_from_buffer_ex(json_parser *p, const char *data, size_t len, size_t threads) {
+    if (!threads)
+        threads = json__default_workers();
+    // Several ranges per worker keep the pool busy when line lengths vary.
+    size_t ranges = len / (64 * 1024) + 1;
+    if (ranges > threads * 8)
+        ranges = threads * 8;
+
+    json_lines *l = json__heap_calloc(1, sizeof *l);
+    json__lines_range *r = json__heap_calloc(ranges, sizeof *r);
+    json_arena *arenas = json__heap_calloc(threads, sizeof *arenas);
+    if (!l || !r || !arenas) {
+        json__heap_free(l);
+        json__heap_free(r);
+        json__heap_free(arenas);
+        p->error = JSON_ERROR_MEMORY;
+        return NULL;
+    }
+    for (size_t i = 0; i < threads; i++)
+        arenas[i].allocator = p->allocator;
+
+    const char *cur = data;
+    const char *end = data + len;
+    for (size_t i = 0; i < ranges; i++) {
+        const char *split = i + 1 == ranges ? end : data + len / ranges * (i + 1);
+        if (split < cur)
+            split = cur;
+        if (split < end) {
+            const char *nl = memchr(split, '\n', end - split);
+            split = nl ? nl + 1 : end;
+        }
+        r[i].begin = cur;
+        r[i].end = split;
+        cur = split;
+    }
+
+    // Lines are already spread over the pool, so none starts a pool of its own.
+    json__lines_job job = {r, arenas, p->flags & ~(unsigned)JSON_PARSE_PARALLEL, json__max_depth(p)};
+    json__parallel_run(ranges, threads, json__lines_parse_range, &job);
+
+    size_t count = 0;
+    int out_of_memory = 0;
+    for (size_t i = 0; i < ranges; i++) {
+        count += r[i].count;
+        out_of_memory |= r[i].out_of_memory;
+    }
+    l->roots = out_of_memory ? NULL : json__heap_alloc((count ? count : 1) * sizeof *l->roots);
+    for (size_t i = 0; i < ranges; i++) {
+        if (l->roots)
+            memcpy(l->roots + l->count, r[i].roots, r[i].count * sizeof *l->roots);
+        l->count += r[i].count;
+        l->failed += r[i].failed;
+        json__heap_free(r[i].roots);
+    }
+    l->arenas = arenas;
+    l->arena_count = threads;
+    p->error = JSON_ERROR_NONE;
+    p->cur = p->end = end;
+    if (!l->roots) {
+        json_lines_free(&l);
+        p->error = JSON_ERROR_MEMORY;
+    } else if (l->failed) {
+        // The position is that of the first line that failed.
+        for (size_t i = 0; i < ranges && p->error == JSON_ERROR_NONE; i++) {
+            if (r[i].failed) {
+                p->error = r[i].error != JSON_ERROR_NONE ? r[i].error : JSON_ERROR_MEMORY;
+                p->cur = r[i].error_at ? r[i].error_at : r[i].end;
+            }
+        }
+    }
+    json__heap_free(r);
+    json__parse_position(p, data);
+    return l;
+}
+
+json_lines *json_lines_from_buffer(const char *data, size_t len, size_t threads) {
+    json_parser p = {0};
+    return json_lines_from_buffer_ex(&p, data, len, threads);
+}
+
+json_lines *json_lines_from_file_ex(json_parser *p, const char *path, size_t threads) {
+    json__file f;
+    if (!json__file_open(&f, path)) {
+        p->error = JSON_ERROR_IO;
+        json__parse_clear_position(p);
+        return NULL;
+    }
+    json_lines *l = json_lines_from_buffer_ex(p, f.data, f.size, threads);
+    if (l && (p->flags & (JSON_PARSE_STRING_VIEWS | JSON_PARSE_LAZY)))
+        l->source = f;
+    else
+        json__file_close(&f);
+    return l;
+}
+
+json_lines *json_lines_from_file(const char *path, size_t threads) {
+    json_parser p = {0};
+    return json_lines_from_file_ex(&p, path, threads);
+}
+
+size_t json_lines_count(json_lines *l) {
+    return l ? l->count : 0;
+}
+
+size_t json_lines_failed(json_lines *l) {
+    return l ? l->failed : 0;
+}
+
+json_value *json_lines_get(json_lines *l, size_t i) {
+    if (!l || i >= l->count)
+        return NULL;
+    return l->roots[i];
+}
+
+void json_lines_free(json_lines **l) {
+    if (!l || !*l)
+        return;
+
+    for (size_t i = 0; i < (*l)->arena_count; i++)
+        json__arena_free(&(*l)->arenas[i]);
+    json__heap_free((*l)->arenas);
+    json__heap_free((*l)->roots);
+    if ((*l)->source.data)
+        json__file_close(&(*l)->source);
+    json__heap_free(*l);
+    *l = NULL;
+}
+
+struct json_lines_reader {
+    FILE *stream;
+    int owns_stream;
+    json_buf buf;
+    size_t start;
+    int eof;
+    json_error error;
+};
+
+json_lines_reader *json_lines_reader_new(FILE *stream) {
+    json_lines_reader *r = json__heap_calloc(1, sizeof *r);
+    if (!r)
+        return NULL;
+    r->stream = stream;
+    return r;
+}
+
+json_lines_reader *json_lines_reader_open(const char *path) {
+    FILE *stream = fopen(path, "rb");
+    if (!stream) {
+        fprintf(stderr, "error, failed to open %s: %s:%d\n", path, __FILE__, __LINE__);
+        return NULL;
+    }
+    json_lines_reader *r = json_lines_reader_new(stream);
+    if (!r) {
+        fclose(stream);
+        return NULL;
+    }
+    r->owns_stream = 1;
+    return r;
+}
+
+json_value *json_lines_reader_next(json_lines_reader *r) {
+    r->error = JSON_ERROR_NONE;
+    while (1) {
+        const char *line = r->buf.data + r->start;
+        size_t avail = r->buf.len - r->start;
+        const char *nl = avail ? memchr(line, '\n', avail) : NULL;
+        if (!nl && !r->eof) {
+            // Slide the partial line to the front and read more behind it.
+            memmove(r->buf.data, line, avail);
+            r->buf.len = avail;
+            r->start = 0;
+            if (!json__buf_reserve(&r->buf, JSON_READ_ENTIRE_FILE_CHUNK)) {
+                r->error = JSON_ERROR_MEMORY;
+                return NULL;
+            }
+            size_t n = fread(r->buf.data + r->buf.len, 1, JSON_READ_ENTIRE_FILE_CHUNK, r->stream);
+            r->buf.len += n;
+            if (n < JSON_READ_ENTIRE_FILE_CHUNK) {
+                if (ferror(r->stream)) {
+                    r->error = JSON_ERROR_IO;
+                    return NULL;
+                }
+                r->eof = 1;
+            }
+            continue;
+        }
+        size_t l = nl ? (size_t)(nl - line) : avail;
+        if (!nl && !l)
+            return NULL;
+        r->start += nl ? l + 1 : l;
+
+        json_parser p = {0};
+        p.cur = line;
+        p.end = line + l;
+        json__skip_whitespace(&p);
+        if (p.cur == p.end)
+            continue;
+        json_value *v = json_from_buffer_ex(&p, p.cur, line + l - p.cur);
+        r->error = p.error;
+        return v;
+    }
+}
+
+json_error json_lines_reader_error(json_lines_reader *r) {
+    return r->error;
+}
+
+void json_lines_reader_close(json_lines_reader **r) {
+    if (!r || !*r)
+        return;
+
+    if ((*r)->owns_stream)
+        fclose((*r)->stream);
+    json_buf_free(&(*r)->buf);
+    json__heap_free(*r);
+    *r = NULL;
+}
+
+json_value *json_get(json_value *obj, const char *key) {
+    if (!obj || obj->type != JSON_OBJECT || !json__materialize(obj))
+        return NULL;
+
+    kvp *e = json__object_find(&obj->object, key, strlen(key));
+    return e ? e->val : NULL;
+}
+
+json_value *json_geti(json_value *arr, size_t index) {
+    if (!arr || arr->type != JSON_ARRAY || !json__materialize(arr))
+        return NULL;
+
+    if (index >= arr->array.count)
+        return NULL;
+
+    return arr->array.items[index];
+}
+
+// Takes owned as the stored key when the key is new and frees it when it
+// already exists; without it the key is copied.
+static int json__object_set(json_value *obj, const char *key, size_t l, json_value *val, char *owned) {
+    if (!obj || obj->type != JSON_OBJECT || (obj->flags & JSON__FLAG_ARENA))
+        return 0;
+
+    kvp *e = json__object_find(&obj->object, key, l);
+    if (e) {
+        json_free(&e->val);
+        e->val = val;
+        json__heap_free(owned);
+        return 1;
+    }
+    if (l > INT32_MAX)
+        return 0;
+
+    struct json_object *o = &obj->object;
+    char *k = owned;
+    if (!k && (k = json__heap_alloc(l + 1))) {
+        memcpy(k, key, l);
+        k[l] = '\0';
+    }
+    if (!k || !json__object_push(NULL, o, (kvp){k, val, (uint32_t)l, 0, 0})) {
+        if (!owned)
+            json__heap_free(k);
+        return 0;
+    }
+
+    if (o->index && 2 * o->count + 2 > o->index[0]) {
+        json__object_build_index(NULL, o);
+    } else if (o->index) {
+        o->items[o->count - 1].hash = json__hash(key, l);
+        json__object_index_insert(o, o->count - 1);
+    } else if (o->count >= JSON_OBJECT_INDEX_THRESHOLD) {
+        json__object_build_index(NULL, o);
+    }
+    return 1;
+}
+
+void json_set(json_value *obj, const char *key, json_value *val) {
+    json__object_set(obj, key, strlen(key), val, NULL);
+}
+
+int json_set_owned(json_value *obj, char *key, json_value *val) {
+    return json__object_set(obj, key, strlen(key), val, key);
+}
+
+int json_reserve(json_value *v, size_t n) {
+    if (!v || (v->flags & JSON__FLAG_ARENA) || n > UINT32_MAX)
+        return 0;
+
+    if (v->type == JSON_OBJECT) {
+        struct json_object *o = &v->object;
+        if (n <= o->cap)
+            return 1;
+        kvp *items = json__heap_realloc(o->items, n * sizeof *items);
+        if (!items)
+            return 0;
+        o->items = items;
+        o->cap = (uint32_t)n;
+        return 1;
+    }
+    if (v->type == JSON_ARRAY) {
+        struct json_array *arr = &v->array;
+        if (n <= arr->cap)
+            return 1;
+        json_value **items;
+        if (arr->items == arr->small) {
+            items = json__heap_alloc(n * sizeof *items);
+            if (items)
+                memcpy(items, arr->small, arr->count * sizeof *items);
+        } else {
+            items = json__heap_realloc(arr->items, n * sizeof *items);
+        }
+        if (!items)
+            return 0;
+        arr->items = items;
+        arr->cap = (uint32_t)n;
+        return 1;
+    }
+    return 0;
+}
 
-    switch (v->type) {
-        case JSON_OBJECT:
-        json__append_string(buffer, buf_size, pos, "{");
-        for (size_t i = 0; i < v->object.count; i++) {
-                json__append_string(buffer, buf_size, pos, "\"%s\":", v->object.items[i].key);
-                json__to_string_helper(v->object.items[i].val, buffer, buf_size, pos);
-                if (i + 1 < v->object.count)
-                    json__append_string(buffer, buf_size, pos, ",");
-            }
-            json__append_string(buffer, buf_size, pos, "}");
-            break;
-        case JSON_ARRAY:
-            json__append_string(buffer, buf_size, pos, "[");
-            for (size_t i = 0; i < v->array.count; i++) {
-                json__to_string_helper(v->array.items[i], buffer, buf_size, pos);
-                if (i + 1 < v->array.count)
-                    json__append_string(buffer, buf_size, pos, ",");
+int json_push(json_value *arr, json_value *val) {
+    if (!arr || arr->type != JSON_ARRAY || (arr->flags & JSON__FLAG_ARENA))
+        return 0;
+
+    return json__array_push(NULL, &arr->array, val);
+}
+
+int json_push_many(json_value *arr, json_value **vals, size_t n) {
+    if (!arr || arr->type != JSON_ARRAY || n > UINT32_MAX - arr->array.count)
+        return 0;
+    if (!json_reserve(arr, arr->array.count + n))
+        return 0;
+
+    if (n)
+        memcpy(arr->array.items + arr->array.count, vals, n * sizeof *vals);
+    arr->array.count += (uint32_t)n;
+    return 1;
+}
+
+void json_object_index(json_value *obj) {
+    if (!obj || obj->type != JSON_OBJECT || (obj->flags & JSON__FLAG_ARENA) || obj->object.index)
+        return;
+
+    json__object_build_index(NULL, &obj->object);
+}
+
+void json_seti(json_value *arr, size_t index, json_value *val) {
+    if (!arr || arr->type != JSON_ARRAY || (arr->flags & JSON__FLAG_ARENA))
+        return;
+
+    if (index >= arr->array.count)
+        return;
+
+    json_free(&arr->array.items[index]);
+
+    arr->array.items[index] = val;
+}
+
+typedef struct {
+    const char *key;
+    size_t len;
+    uint32_t hash;
+    size_t index;
+} json__path_token;
+
+struct json_path {
+    size_t count;
+    json__path_token *tokens;
+};
+
+// Tokens are unescaped into the same allocation, after the token array.
+static json_path *json__path_compile(const char *pointer, size_t l) {
+    if (l && *pointer != '/')
+        return NULL;
+
+    size_t count = 0;
+    for (size_t i = 0; i < l; i++)
+        count += pointer[i] == '/';
+    json_path *path = json__heap_alloc(sizeof *path + count * sizeof *path->tokens + l);
+    if (!path)
+        return NULL;
+    path->count = count;
+    path->tokens = (json__path_token *)(path + 1);
+    char *keys = (char *)(path->tokens + count);
+
+    const char *s = pointer;
+    const char *end = pointer + l;
+    for (size_t t = 0; t < count; t++) {
+        json__path_token *tok = &path->tokens[t];
+        s++;
+        tok->key = keys;
+        for (; s < end && *s != '/'; s++) {
+            if (*s == '~') {
+                s++;
+                if (s == end || (*s != '0' && *s != '1')) {
+                    json__heap_free(path);
+                    return NULL;
+                }
+                *keys++ = *s == '0' ? '~' : '/';
+            } else {
+                *keys++ = *s;
             }
-            json__append_string(buffer, buf_size, pos, "]");
-            break;
-        case JSON_STRING:
-            json__append_string(buffer, buf_size, pos, "\"%s\"", v->string);
-            break;
-        case JSON_NUMBER:
-            json__append_string(buffer, buf_size, pos, "%g", v->number);
-            break;
-        case JSON_BOOL:
-            json__append_string(buffer, buf_size, pos, v->boolean ? "true" : "false");
-            break;
-        case JSON_NULL:
-            json__append_string(buffer, buf_size, pos, "null");
-            break;
+        }
+        tok->len = keys - tok->key;
+        tok->hash = json__hash(tok->key, tok->len);
+
+        // Array indexes are decimal without leading zeros; "-", the end of
+        // an array, never names an element.
+        tok->index = (size_t)-1;
+        if (tok->len && (tok->len == 1 || tok->key[0] != '0')) {
+            size_t index = 0;
+            size_t i = 0;
+            for (; i < tok->len && isdigit((unsigned char)tok->key[i]); i++) {
+                if (index > ((size_t)-1 - 9) / 10)
+                    break;
+                index = index * 10 + (tok->key[i] - '0');
+            }
+            if (i == tok->len)
+                tok->index = index;
+        }
     }
+    return path;
 }
 
-char* json_to_string(json_value *v) {
-    if (!v)
+json_path *json_path_compile(const char *pointer) {
+    return json__path_compile(pointer, strlen(pointer));
+}
+
+void json_path_free(json_path **path) {
+    if (!path || !*path)
+        return;
+
+    json__heap_free(*path);
+    *path = NULL;
+}
+
+json_value *json_path_get(const json_path *path, json_value *root) {
+    json_value *v = root;
+    for (size_t t = 0; v && t < path->count; t++) {
+        const json__path_token *tok = &path->tokens[t];
+        if (!json__materialize(v))
+            return NULL;
+        if (v->type == JSON_OBJECT) {
+            kvp *e = json__object_find_hashed(&v->object, tok->key, tok->len, tok->hash);
+            v = e ? e->val : NULL;
+        } else if (v->type == JSON_ARRAY) {
+            v = tok->index < v->array.count ? v->array.items[tok->index] : NULL;
+        } else {
+            v = NULL;
+        }
+    }
+    return v;
+}
+
+json_value *json_pointer_get(json_value *root, const char *pointer) {
+    json_path *path = json_path_compile(pointer);
+    if (!path)
         return NULL;
+    json_value *v = json_path_get(path, root);
+    json_path_free(&path);
+    return v;
+}
 
-    size_t buf_size = 256;
-    char *buffer = malloc(buf_size);
-    if (!buffer)
+static json_value *json__new_string_n(const char *s, size_t l) {
+    json_value *v = json__new_value(NULL, JSON_STRING);
+    if (!v)
         return NULL;
+    if (!(v->string.data = json__heap_alloc(l + 1))) {
+        json_free(&v);
+        return NULL;
+    }
+    memcpy(v->string.data, s, l);
+    v->string.data[l] = '\0';
+    v->string.len = l;
+    return v;
+}
 
-    size_t pos = 0;
-    json__to_string_helper(v, &buffer, &buf_size, &pos);
+// Detaches the member or element from its container, handing it to *val.
+static int json__object_take(json_value *obj, const char *key, size_t l, json_value **val) {
+    if (!obj || obj->type != JSON_OBJECT || (obj->flags & JSON__FLAG_ARENA))
+        return 0;
 
-    if (pos >= buf_size) {
-        buffer = realloc(buffer, pos + 1);
-        if (!buffer)
-            return NULL;
+    struct json_object *o = &obj->object;
+    kvp *e = json__object_find(o, key, l);
+    if (!e)
+        return 0;
+    *val = e->val;
+    if (!e->key_borrowed)
+        json__heap_free(e->key);
+    memmove(e, e + 1, (o->count - (e - o->items) - 1) * sizeof *e);
+    o->count--;
+    // Every later member moved down a slot, so the index is rebuilt, or
+    // dropped in favour of a linear search if that fails.
+    if (o->index && !json__object_build_index(NULL, o)) {
+        json__heap_free(o->index);
+        o->index = NULL;
     }
-    buffer[pos] = '\0';
+    return 1;
+}
 
-    return buffer;
+static int json__array_take(json_value *arr, size_t index, json_value **val) {
+    if (!arr || arr->type != JSON_ARRAY || (arr->flags & JSON__FLAG_ARENA) || index >= arr->array.count)
+        return 0;
+
+    json_value **items = arr->array.items;
+    *val = items[index];
+    memmove(items + index, items + index + 1, (arr->array.count - index - 1) * sizeof *items);
+    arr->array.count--;
+    return 1;
 }
 
-json_value *json_get(json_value *obj, const char *key) {
-    if (!obj || obj->type != JSON_OBJECT)
+int json_remove(json_value *obj, const char *key) {
+    json_value *v;
+    if (!json__object_take(obj, key, strlen(key), &v))
+        return 0;
+    json_free(&v);
+    return 1;
+}
+
+int json_removei(json_value *arr, size_t index) {
+    json_value *v;
+    if (!json__array_take(arr, index, &v))
+        return 0;
+    json_free(&v);
+    return 1;
+}
+
+int json_inserti(json_value *arr, size_t index, json_value *val) {
+    if (!arr || arr->type != JSON_ARRAY || index > arr->array.count || !json_push(arr, val))
+        return 0;
+
+    json_value **items = arr->array.items;
+    memmove(items + index + 1, items + index, (arr->array.count - index - 1) * sizeof *items);
+    items[index] = val;
+    return 1;
+}
+
+static int json__patch_member(json_value *o, const char *key, json_value *v) {
+    if (v && json__object_set(o, key, strlen(key), v, NULL))
+        return 1;
+    json_free(&v);
+    return 0;
+}
+
+// Appends {"op", "path", "value"} to patch, taking value in every case.
+static int json__patch_emit(json_value *patch, const char *op, const json_buf *path, json_value *value) {
+    json_value *o = json_new_object();
+    int ok = o && json__patch_member(o, "op", json__new_string_n(op, strlen(op))) &&
+             json__patch_member(o, "path", json__new_string_n(path->data, path->len));
+    if (ok && value)
+        ok = json__patch_member(o, "value", value);
+    else
+        json_free(&value);
+    if (ok && json_push(patch, o))
+        return 1;
+    json_free(&o);
+    return 0;
+}
+
+static int json__pointer_append(json_buf *b, const char *key, size_t l, size_t index) {
+    if (!key) {
+        char n[JSON__NUMBER_BUFFER_SIZE];
+        return json__buf_putc(b, '/') && json__buf_append(b, n, json__format_integer(n, (int64_t)index));
+    }
+    if (!json__buf_putc(b, '/'))
+        return 0;
+    for (size_t i = 0; i < l; i++) {
+        int ok = key[i] == '~'   ? json__buf_append(b, "~0", 2)
+                 : key[i] == '/' ? json__buf_append(b, "~1", 2)
+                                 : json__buf_putc(b, key[i]);
+        if (!ok)
+            return 0;
+    }
+    return 1;
+}
+
+// A pair still to compare, its path being the one left in the path buffer
+// at parent_len plus its own token: key, or index when key is NULL.
+typedef struct {
+    json_value *a;
+    json_value *b;
+    size_t parent_len;
+    const char *key;
+    size_t key_len;
+    size_t index;
+} json__diff_item;
+
+// Containers of the same kind are compared member by member and anything
+// else that differs is replaced whole. Arrays lose their common prefix and
+// suffix first, then pair up what is left by position, removing or adding
+// the surplus at the end of the middle; every pair lies below the surplus,
+// so the order in which the operations come out does not move any of them.
+json_value *json_diff(json_value *a, json_value *b) {
+    if (!a || !b)
         return NULL;
 
-    for (size_t i = 0; i < obj->object.count; i++)
-        if (strcmp(obj->object.items[i].key, key) == 0)
-            return obj->object.items[i].val;
+    json_value *patch = json_new_array();
+    json_buf path = {0};
+    json__diff_item small[32];
+    json__diff_item *stack = small;
+    size_t depth = 0;
+    size_t cap = sizeof small / sizeof *small;
+    if (!patch || !json__buf_reserve(&path, 0))
+        goto fail;
+    stack[depth++] = (json__diff_item){a, b, 0, NULL, 0, (size_t)-1};
+
+    while (depth) {
+        json__diff_item it = stack[--depth];
+        path.len = it.parent_len;
+        if ((it.key || it.index != (size_t)-1) && !json__pointer_append(&path, it.key, it.key_len, it.index))
+            goto fail;
+        if (it.a == it.b)
+            continue;
+        json__materialize(it.a);
+        json__materialize(it.b);
+        size_t here = path.len;
+
+        if (it.a->type == JSON_OBJECT && it.b->type == JSON_OBJECT) {
+            struct json_object *oa = &it.a->object;
+            struct json_object *ob = &it.b->object;
+            for (size_t i = 0; i < oa->count; i++) {
+                kvp *e = &oa->items[i];
+                kvp *m = json__object_find(ob, e->key, e->key_len);
+                if (!m) {
+                    if (!json__pointer_append(&path, e->key, e->key_len, 0) ||
+                        !json__patch_emit(patch, "remove", &path, NULL))
+                        goto fail;
+                    path.len = here;
+                    continue;
+                }
+                if (depth == cap && !json__grow_stack((void **)&stack, small, sizeof small, &cap, sizeof *stack))
+                    goto fail;
+                stack[depth++] = (json__diff_item){e->val, m->val, here, e->key, e->key_len, 0};
+            }
+            for (size_t i = 0; i < ob->count; i++) {
+                kvp *m = &ob->items[i];
+                if (json__object_find(oa, m->key, m->key_len))
+                    continue;
+                json_value *c = json_clone(m->val);
+                if (!c || !json__pointer_append(&path, m->key, m->key_len, 0) ||
+                    !json__patch_emit(patch, "add", &path, c))
+                    goto fail;
+                path.len = here;
+            }
+        } else if (it.a->type == JSON_ARRAY && it.b->type == JSON_ARRAY) {
+            json_value **ia = it.a->array.items;
+            json_value **ib = it.b->array.items;
+            size_t na = it.a->array.count;
+            size_t nb = it.b->array.count;
+            size_t pre = 0;
+            while (pre < na && pre < nb && json_equal(ia[pre], ib[pre]))
+                pre++;
+            size_t suf = 0;
+            while (suf < na - pre && suf < nb - pre && json_equal(ia[na - 1 - suf], ib[nb - 1 - suf]))
+                suf++;
+            size_t ma = na - pre - suf;
+            size_t mb = nb - pre - suf;
+            size_t pairs = ma < mb ? ma : mb;
+            for (size_t i = ma; i > pairs; i--) {
+                if (!json__pointer_append(&path, NULL, 0, pre + pairs) ||
+                    !json__patch_emit(patch, "remove", &path, NULL))
+                    goto fail;
+                path.len = here;
+            }
+            for (size_t i = pairs; i < mb; i++) {
+                json_value *c = json_clone(ib[pre + i]);
+                if (!c || !json__pointer_append(&path, NULL, 0, pre + i) ||
+                    !json__patch_emit(patch, "add", &path, c))
+                    goto fail;
+                path.len = here;
+            }
+            for (size_t i = pairs; i-- > 0;) {
+                if (depth == cap && !json__grow_stack((void **)&stack, small, sizeof small, &cap, sizeof *stack))
+                    goto fail;
+                stack[depth++] = (json__diff_item){ia[pre + i], ib[pre + i], here, NULL, 0, pre + i};
+            }
+        } else if (!json__equal_shallow(it.a, it.b)) {
+            json_value *c = json_clone(it.b);
+            if (!c || !json__patch_emit(patch, "replace", &path, c))
+                goto fail;
+        }
+    }
+    json_buf_free(&path);
+    if (stack != small)
+        json__heap_free(stack);
+    return patch;
 
+fail:
+    json_free(&patch);
+    json_buf_free(&path);
+    if (stack != small)
+        json__heap_free(stack);
     return NULL;
 }
 
-json_value *json_geti(json_value *arr, size_t index) {
-    if (!arr || arr->type != JSON_ARRAY)
+// parent is the container that holds the target of path, or NULL.
+typedef struct {
+    json_value *parent;
+    const json__path_token *last;
+} json__patch_target;
+
+static json__patch_target json__patch_locate(json_value *root, const json_path *path) {
+    json__patch_target t = {NULL, NULL};
+    if (!path->count)
+        return t;
+    json_path up = {path->count - 1, path->tokens};
+    t.parent = json_path_get(&up, root);
+    t.last = &path->tokens[path->count - 1];
+    if (t.parent && (t.parent->type != JSON_OBJECT && t.parent->type != JSON_ARRAY))
+        t.parent = NULL;
+    return t;
+}
+
+// Leaves val with the caller on failure.
+static int json__patch_add(json_value **root, const json_path *path, json_value *val) {
+    if (!path->count) {
+        if ((*root)->flags & JSON__FLAG_ARENA)
+            return 0;
+        json_free(root);
+        *root = val;
+        return 1;
+    }
+    json__patch_target t = json__patch_locate(*root, path);
+    if (!t.parent)
+        return 0;
+    if (t.parent->type == JSON_OBJECT)
+        return json__object_set(t.parent, t.last->key, t.last->len, val, NULL);
+    if (t.last->len == 1 && t.last->key[0] == '-')
+        return json_push(t.parent, val);
+    return json_inserti(t.parent, t.last->index, val);
+}
+
+// *index is where the value sat in its parent, for json__patch_restore.
+static int json__patch_take(json_value *root, const json_path *path, json_value **val, size_t *index) {
+    json__patch_target t = json__patch_locate(root, path);
+    if (!t.parent)
+        return 0;
+    if (t.parent->type == JSON_OBJECT) {
+        kvp *e = json__object_find(&t.parent->object, t.last->key, t.last->len);
+        if (!e)
+            return 0;
+        *index = e - t.parent->object.items;
+        return json__object_take(t.parent, t.last->key, t.last->len, val);
+    }
+    *index = t.last->index;
+    return json__array_take(t.parent, t.last->index, val);
+}
+
+// Puts a value taken by json__patch_take back where it was, members after it
+// included.
+static int json__patch_restore(json_value *root, const json_path *path, size_t index, json_value *val) {
+    json__patch_target t = json__patch_locate(root, path);
+    if (!t.parent)
+        return 0;
+    if (t.parent->type == JSON_ARRAY)
+        return json_inserti(t.parent, index, val);
+    if (!json__object_set(t.parent, t.last->key, t.last->len, val, NULL))
+        return 0;
+    struct json_object *o = &t.parent->object;
+    kvp e = o->items[o->count - 1];
+    memmove(o->items + index + 1, o->items + index, (o->count - 1 - index) * sizeof e);
+    o->items[index] = e;
+    if (o->index && !json__object_build_index(NULL, o)) {
+        json__heap_free(o->index);
+        o->index = NULL;
+    }
+    return 1;
+}
+
+static int json__patch_replace(json_value **root, const json_path *path, json_value *val) {
+    if (!path->count)
+        return json__patch_add(root, path, val);
+    json__patch_target t = json__patch_locate(*root, path);
+    if (!t.parent || (t.parent->flags & JSON__FLAG_ARENA))
+        return 0;
+    if (t.parent->type == JSON_OBJECT) {
+        return json__object_find(&t.parent->object, t.last->key, t.last->len) &&
+               json__object_set(t.parent, t.last->key, t.last->len, val, NULL);
+    }
+    if (t.last->index >= t.parent->array.count)
+        return 0;
+    json_free(&t.parent->array.items[t.last->index]);
+    t.parent->array.items[t.last->index] = val;
+    return 1;
+}
+
+static int json__string_is(json_value *v, const char *s) {
+    size_t l = strlen(s);
+    return v && v->type == JSON_STRING && v->string.len == l && memcmp(v->string.data, s, l) == 0;
+}
+
+static json_path *json__patch_path(json_value *op, const char *key) {
+    json_value *v = json_get(op, key);
+    return v && v->type == JSON_STRING ? json__path_compile(v->string.data, v->string.len) : NULL;
+}
+
+// Whether from names a proper ancestor of path.
+static int json__path_contains(const json_path *from, const json_path *path) {
+    if (from->count >= path->count)
+        return 0;
+    for (size_t t = 0; t < from->count; t++)
+        if (from->tokens[t].len != path->tokens[t].len ||
+            memcmp(from->tokens[t].key, path->tokens[t].key, from->tokens[t].len) != 0)
+            return 0;
+    return 1;
+}
+
+static int json__patch_apply(json_value **root, json_value *op) {
+    json_value *name = json_get(op, "op");
+    json_value *value = json_get(op, "value");
+    json_path *path = json__patch_path(op, "path");
+    json_path *from = NULL;
+    json_value *v = NULL;
+    int ok = 0;
+    if (!path)
+        return 0;
+
+    if (json__string_is(name, "add") || json__string_is(name, "replace")) {
+        if (value && (v = json_clone(value)))
+            ok = json__string_is(name, "add") ? json__patch_add(root, path, v) : json__patch_replace(root, path, v);
+    } else if (json__string_is(name, "remove")) {
+        size_t index;
+        ok = json__patch_take(*root, path, &v, &index);
+        json_free(&v);
+    } else if (json__string_is(name, "test")) {
+        json_value *target = json_path_get(path, *root);
+        ok = target && value && json_equal(target, value);
+    } else if (json__string_is(name, "copy")) {
+        json_value *source = (from = json__patch_path(op, "from")) ? json_path_get(from, *root) : NULL;
+        if (source && (v = json_clone(source)))
+            ok = json__patch_add(root, path, v);
+    } else if (json__string_is(name, "move")) {
+        // Moving a value into itself is refused; back where it came from is
+        // a no-op. A failed add puts the value back where it was.
+        size_t index;
+        if ((from = json__patch_path(op, "from")) && !json__path_contains(from, path)) {
+            if (!from->count)
+                ok = !path->count;
+            else if (json__patch_take(*root, from, &v, &index) && !(ok = json__patch_add(root, path, v)) &&
+                     !json__patch_restore(*root, from, index, v))
+                json_free(&v);
+            v = NULL;
+        }
+    }
+    // Whatever is left in v did not make it into the tree.
+    if (!ok)
+        json_free(&v);
+    json_path_free(&from);
+    json_path_free(&path);
+    return ok;
+}
+
+int json_apply_patch(json_value **root, json_value *patch) {
+    if (!root || !*root || !patch || patch->type != JSON_ARRAY || !json__materialize(patch))
+        return 0;
+
+    for (size_t i = 0; i < patch->array.count; i++)
+        if (!json__patch_apply(root, patch->array.items[i]))
+            return 0;
+    return 1;
+}
+
+typedef struct {
+    json_value *target;
+    json_value *patch;
+} json__merge_frame;
+
+// RFC 7396. Nested patch objects merge into the target's objects, or into
+// new empty ones that replace other values, so a null inside one always
+// means removal and never makes it into the tree.
+int json_merge_patch(json_value **root, json_value *patch) {
+    if (!root || !*root || !patch || ((*root)->flags & JSON__FLAG_ARENA))
+        return 0;
+
+    json__materialize(patch);
+    if (patch->type != JSON_OBJECT || (*root)->type != JSON_OBJECT) {
+        json_value *v = patch->type == JSON_OBJECT ? json_new_object() : json_clone(patch);
+        if (!v)
+            return 0;
+        json_free(root);
+        *root = v;
+        if (patch->type != JSON_OBJECT)
+            return 1;
+    }
+
+    json__merge_frame small[32];
+    json__merge_frame *stack = small;
+    size_t depth = 0;
+    size_t cap = sizeof small / sizeof *small;
+    int ok = 1;
+    stack[depth++] = (json__merge_frame){*root, patch};
+    while (ok && depth) {
+        json__merge_frame f = stack[--depth];
+        for (size_t i = 0; ok && i < f.patch->object.count; i++) {
+            kvp *e = &f.patch->object.items[i];
+            json_value *p = e->val;
+            json_value *t;
+            if (p)
+                json__materialize(p);
+            if (!p || p->type == JSON_NULL) {
+                if (json__object_take(f.target, e->key, e->key_len, &t))
+                    json_free(&t);
+                continue;
+            }
+            kvp *m = json__object_find(&f.target->object, e->key, e->key_len);
+            if (p->type == JSON_OBJECT && m && m->val && m->val->type == JSON_OBJECT) {
+                t = m->val;
+            } else {
+                t = p->type == JSON_OBJECT ? json_new_object() : json_clone(p);
+                if (!t || !json__object_set(f.target, e->key, e->key_len, t, NULL)) {
+                    json_free(&t);
+                    ok = 0;
+                    break;
+                }
+                if (p->type != JSON_OBJECT)
+                    continue;
+            }
+            if (depth == cap && !json__grow_stack((void **)&stack, small, sizeof small, &cap, sizeof *stack)) {
+                ok = 0;
+                break;
+            }
+            stack[depth++] = (json__merge_frame){t, p};
+        }
+    }
+    if (stack != small)
+        json__heap_free(stack);
+    return ok;
+}
+
+// Skips over one value, checking scalars only as far as their extent.
+static int json__skip_value(json_parser *p) {
+    int escaped;
+    if (p->cur >= p->end)
+        goto fail;
+    if (*p->cur == '"') {
+        p->cur++;
+        if (!json__skip_string(p, &escaped))
+            return 0;
+        p->cur++;
+        return 1;
+    }
+    if (*p->cur == '{' || *p->cur == '[')
+        return json__skip_container(p, json__max_depth(p));
+    const char *s = p->cur;
+    while (p->cur < p->end && !json__is_space(*p->cur) && !json__is_structural(*p->cur))
+        p->cur++;
+    if (p->cur != s)
+        return 1;
+
+fail:
+    p->error = JSON_ERROR_SYNTAX;
+    return 0;
+}
+
+static json_value *json__path_extract(json_parser *p, const json_path *path) {
+    for (size_t t = 0; t < path->count; t++) {
+        const json__path_token *tok = &path->tokens[t];
+        json__skip_whitespace(p);
+        if (p->cur >= p->end)
+            goto fail;
+        if (*p->cur == '{') {
+            p->cur++;
+            json__skip_whitespace(p);
+            if (p->cur < p->end && *p->cur == '}')
+                return NULL;
+            while (1) {
+                json__skip_whitespace(p);
+                if (p->cur >= p->end || *p->cur != '"')
+                    goto fail;
+                const char *k = ++p->cur;
+                int escaped;
+                if (!json__skip_string(p, &escaped))
+                    goto fail;
+                const char *close = p->cur;
+                size_t l = close - k;
+                int match = 0;
+                if (l == tok->len || (escaped && l > tok->len)) {
+                    char small[256];
+                    const char *x = json__string_view(p, k, &l, escaped, small, sizeof small);
+                    if (!x)
+                        goto fail;
+                    match = l == tok->len && memcmp(x, tok->key, l) == 0;
+                    json__string_view_free(x, k, small);
+                }
+                p->cur = close + 1;
+                json__skip_whitespace(p);
+                if (p->cur >= p->end || *p->cur != ':')
+                    goto fail;
+                p->cur++;
+                json__skip_whitespace(p);
+                if (match)
+                    break;
+                if (!json__skip_value(p))
+                    goto fail;
+                json__skip_whitespace(p);
+                if (p->cur < p->end && *p->cur == ',') {
+                    p->cur++;
+                    continue;
+                }
+                if (p->cur < p->end && *p->cur == '}')
+                    return NULL;
+                goto fail;
+            }
+        } else if (*p->cur == '[') {
+            p->cur++;
+            json__skip_whitespace(p);
+            if (tok->index == (size_t)-1 || (p->cur < p->end && *p->cur == ']'))
+                return NULL;
+            for (size_t i = 0; i < tok->index; i++) {
+                if (!json__skip_value(p))
+                    goto fail;
+                json__skip_whitespace(p);
+                if (p->cur < p->end && *p->cur == ']')
+                    return NULL;
+                if (p->cur >= p->end || *p->cur != ',')
+                    goto fail;
+                p->cur++;
+                json__skip_whitespace(p);
+            }
+        } else {
+            return NULL;
+        }
+    }
+    return json__parse_value(p);
+
+fail:
+    if (p->error == JSON_ERROR_NONE)
+        p->error = JSON_ERROR_SYNTAX;
+    return NULL;
+}
+
+json_value *json_path_extract_ex(json_parser *p, const json_path *path, const char *data, size_t len) {
+    p->cur = data;
+    p->end = data + len;
+    p->error = JSON_ERROR_NONE;
+    JSON__STATS_CLOCK(t);
+    json_value *v = json__path_extract(p, path);
+    json__parse_position(p, data);
+    JSON__STATS_ADD(parses, 1);
+    JSON__STATS_ADD(bytes_parsed, p->cur - data);
+    JSON__STATS_ELAPSED(parse_ns, t);
+    return v;
+}
+
+json_value *json_path_extract(const json_path *path, const char *data, size_t len) {
+    json_parser p = {0};
+    return json_path_extract_ex(&p, path, data, len);
+}
+
+json_value *json_path_extract_file(const json_path *path, const char *filename) {
+    json__file f;
+    if (!json__file_open(&f, filename))
         return NULL;
+    json_value *v = json_path_extract(path, f.data, f.size);
+    json__file_close(&f);
+    return v;
+}
 
-    if (index >= arr->array.count)
+typedef struct {
+    size_t key_len;
+    json_schema *nested;
+} json__schema_entry;
+
+struct json_schema {
+    const json_field *fields;
+    size_t count;
+    json__schema_entry *entries;
+    uint32_t *slots;
+    uint32_t mask;
+    uint32_t *seeds;
+    uint32_t buckets;
+    int full;
+};
+
+// Keys mostly differ in their length or first or last eight bytes, which
+// the fast hash reads; a table where they do not falls back to hashing
+// every byte.
+static uint64_t json__schema_word(const json_schema *s, const char *k, size_t l) {
+    uint64_t w = 0;
+    if (s->full)
+        return json__hash64(k, l);
+    memcpy(&w, k, l < 8 ? l : 8);
+    if (l > 8) {
+        uint64_t t;
+        memcpy(&t, k + l - 8, sizeof t);
+        w ^= t * 0x9e3779b97f4a7c15ull;
+    }
+    return w ^ (uint64_t)l << 56;
+}
+
+static uint32_t json__schema_bucket(const json_schema *s, uint64_t w) {
+    return (uint32_t)(json__mix(w) >> 32) % s->buckets;
+}
+
+static uint32_t json__schema_slot(const json_schema *s, uint64_t w, uint32_t seed) {
+    return (uint32_t)json__mix(w ^ (uint64_t)seed * 0x9e3779b97f4a7c15ull) & s->mask;
+}
+
+// Hash and displace: keys are spread over buckets of about four, then each
+// bucket, largest first, searches for a seed that sends all its keys to
+// free slots. A lookup costs two hashes of one word and one compare.
+static int json__schema_perfect(json_schema *s) {
+    size_t slots = 2;
+    while (slots < 2 * s->count)
+        slots *= 2;
+    s->mask = (uint32_t)(slots - 1);
+    s->buckets = (uint32_t)(s->count / 4 + 1);
+    s->slots = json__heap_calloc(slots, sizeof *s->slots);
+    s->seeds = json__heap_calloc(s->buckets, sizeof *s->seeds);
+    uint64_t *words = json__heap_alloc((s->count ? s->count : 1) * sizeof *words);
+    uint32_t *order = json__heap_alloc((s->count ? s->count : 1) * sizeof *order);
+    uint32_t *sizes = json__heap_calloc(s->buckets + 1, sizeof *sizes);
+    int ok = 0;
+    if (!s->slots || !s->seeds || !words || !order || !sizes)
+        goto done;
+
+    for (int full = 0; full < 2 && !ok; full++) {
+        s->full = full;
+        memset(s->slots, 0, slots * sizeof *s->slots);
+        memset(sizes, 0, (s->buckets + 1) * sizeof *sizes);
+        for (size_t i = 0; i < s->count; i++) {
+            words[i] = json__schema_word(s, s->fields[i].key, s->entries[i].key_len);
+            sizes[json__schema_bucket(s, words[i]) + 1]++;
+        }
+        // Keys sorted by bucket, buckets then visited largest first.
+        for (uint32_t b = 0; b < s->buckets; b++)
+            sizes[b + 1] += sizes[b];
+        for (size_t i = 0; i < s->count; i++)
+            order[sizes[json__schema_bucket(s, words[i])]++] = (uint32_t)i;
+        for (uint32_t b = s->buckets; b > 0; b--)
+            sizes[b] = sizes[b - 1];
+        sizes[0] = 0;
+        uint32_t largest = 0;
+        for (uint32_t b = 0; b < s->buckets; b++)
+            if (sizes[b + 1] - sizes[b] > largest)
+                largest = sizes[b + 1] - sizes[b];
+
+        ok = 1;
+        for (uint32_t n = largest; n > 0 && ok; n--) {
+            for (uint32_t b = 0; b < s->buckets && ok; b++) {
+                uint32_t first = sizes[b];
+                uint32_t last = sizes[b + 1];
+                if (last - first != n)
+                    continue;
+                uint32_t seed = 1;
+                for (; seed < (1u << 16); seed++) {
+                    uint32_t i = first;
+                    for (; i < last; i++) {
+                        uint32_t j = json__schema_slot(s, words[order[i]], seed);
+                        if (s->slots[j])
+                            break;
+                        s->slots[j] = order[i] + 1;
+                    }
+                    if (i == last)
+                        break;
+                    while (i-- > first)
+                        s->slots[json__schema_slot(s, words[order[i]], seed)] = 0;
+                }
+                if (seed == (1u << 16))
+                    ok = 0;
+                s->seeds[b] = seed;
+            }
+        }
+    }
+
+done:
+    json__heap_free(words);
+    json__heap_free(order);
+    json__heap_free(sizes);
+    return ok;
+}
+
+json_schema *json_schema_new(const json_field *fields, size_t count) {
+    if (count > UINT32_MAX / 16)
         return NULL;
+    json_schema *s = json__heap_alloc(sizeof *s);
+    if (!s)
+        return NULL;
+    s->fields = fields;
+    s->count = count;
+    s->slots = NULL;
+    s->seeds = NULL;
+    s->entries = json__heap_calloc(count ? count : 1, sizeof *s->entries);
+    if (!s->entries)
+        goto fail;
+    for (size_t i = 0; i < count; i++) {
+        s->entries[i].key_len = strlen(fields[i].key);
+        for (size_t j = 0; j < i; j++) {
+            if (strcmp(fields[i].key, fields[j].key) == 0) {
+                fprintf(stderr, "error, schema key \"%s\" appears twice\n", fields[i].key);
+                goto fail;
+            }
+        }
+        if (fields[i].type == JSON_FIELD_OBJECT &&
+            !(s->entries[i].nested = json_schema_new(fields[i].fields, fields[i].count)))
+            goto fail;
+    }
+    if (!json__schema_perfect(s))
+        goto fail;
+    return s;
 
-    return arr->array.items[index];
+fail:
+    json_schema_free(&s);
+    return NULL;
 }
 
-void json_set(json_value *obj, const char *key, json_value *val) {
-    if (!obj || obj->type != JSON_OBJECT)
+void json_schema_free(json_schema **s) {
+    if (!s || !*s)
         return;
-    
-    for (size_t i = 0; i < obj->object.count; i++)
-        if (strcmp(obj->object.items[i].key, key) == 0) {
-            json_free(&obj->object.items[i].val);
-            obj->object.items[i].val = val;
-            return;
+
+    if ((*s)->entries)
+        for (size_t i = 0; i < (*s)->count; i++)
+            json_schema_free(&(*s)->entries[i].nested);
+    json__heap_free((*s)->entries);
+    json__heap_free((*s)->slots);
+    json__heap_free((*s)->seeds);
+    json__heap_free(*s);
+    *s = NULL;
+}
+
+void json_schema_release(const json_schema *s, void *out) {
+    for (size_t i = 0; i < s->count; i++) {
+        char *at = (char *)out + s->fields[i].offset;
+        if (s->fields[i].type == JSON_FIELD_STRING) {
+            json__heap_free(*(char **)at);
+            *(char **)at = NULL;
+        } else if (s->fields[i].type == JSON_FIELD_VALUE) {
+            json_free((json_value **)at);
+        } else if (s->fields[i].type == JSON_FIELD_OBJECT) {
+            json_schema_release(s->entries[i].nested, at);
         }
-    
-    if (obj->object.count == obj->object.cap)
-        obj->object.items = realloc(obj->object.items, (obj->object.cap *= 2) * sizeof(kvp));
-    obj->object.items[obj->object.count++] = (kvp){strdup(key), val};
+    }
 }
 
-void json_seti(json_value *arr, size_t index, json_value *val) {
-    if (!arr || arr->type != JSON_ARRAY)
-        return;
+static size_t json__schema_find(const json_schema *s, const char *k, size_t l) {
+    if (!s->count)
+        return (size_t)-1;
+    uint64_t w = json__schema_word(s, k, l);
+    uint32_t slot = s->slots[json__schema_slot(s, w, s->seeds[json__schema_bucket(s, w)])];
+    if (!slot || s->entries[slot - 1].key_len != l || memcmp(s->fields[slot - 1].key, k, l) != 0)
+        return (size_t)-1;
+    return slot - 1;
+}
 
-    if (index >= arr->array.count)
-        return;
+static int json__schema_value(json_parser *p, const json_schema *s, size_t i, char *out);
 
-    json_free(&arr->array.items[index]);
+// Nesting follows the schema, so the C stack it takes is bounded by the
+// schema's depth; unknown containers are skipped without recursing.
+static int json__schema_object(json_parser *p, const json_schema *s, char *out) {
+    uint64_t seen_small = 0;
+    uint64_t *seen = s->count <= 64 ? &seen_small : json__heap_calloc((s->count + 63) / 64, sizeof *seen);
+    if (!seen) {
+        p->error = JSON_ERROR_MEMORY;
+        return 0;
+    }
 
-    arr->array.items[index] = val;
+    json__skip_whitespace(p);
+    if (p->cur >= p->end || *p->cur != '{')
+        goto type;
+    p->cur++;
+    json__skip_whitespace(p);
+    if (p->cur < p->end && *p->cur == '}') {
+        p->cur++;
+        goto done;
+    }
+    while (1) {
+        json__skip_whitespace(p);
+        if (p->cur >= p->end || *p->cur != '"')
+            goto fail;
+        const char *k = ++p->cur;
+        int escaped;
+        if (!json__skip_string(p, &escaped))
+            goto fail;
+        const char *close = p->cur;
+        size_t l = close - k;
+        char small[256];
+        const char *x = json__string_view(p, k, &l, escaped, small, sizeof small);
+        if (!x)
+            goto fail;
+        size_t i = json__schema_find(s, x, l);
+        json__string_view_free(x, k, small);
+        p->cur = close + 1;
+        json__skip_whitespace(p);
+        if (p->cur >= p->end || *p->cur != ':')
+            goto fail;
+        p->cur++;
+        json__skip_whitespace(p);
+
+        if (i == (size_t)-1 || (seen[i / 64] >> (i % 64) & 1)) {
+            if (!json__skip_value(p))
+                goto fail;
+        } else {
+            seen[i / 64] |= (uint64_t)1 << (i % 64);
+            if (!json__schema_value(p, s, i, out))
+                goto fail;
+        }
+
+        json__skip_whitespace(p);
+        if (p->cur < p->end && *p->cur == ',') {
+            p->cur++;
+            continue;
+        }
+        if (p->cur < p->end && *p->cur == '}') {
+            p->cur++;
+            break;
+        }
+        goto fail;
+    }
+
+done:
+    if (seen != &seen_small)
+        json__heap_free(seen);
+    return 1;
+
+type:
+    p->error = JSON_ERROR_TYPE;
+fail:
+    if (p->error == JSON_ERROR_NONE)
+        p->error = JSON_ERROR_SYNTAX;
+    if (seen != &seen_small)
+        json__heap_free(seen);
+    return 0;
+}
+
+static int json__schema_value(json_parser *p, const json_schema *s, size_t i, char *out) {
+    const json_field *f = &s->fields[i];
+    char *at = out + f->offset;
+    if (p->cur >= p->end)
+        goto fail;
+    if (json__match_literal(p, "null", 4))
+        return 1;
+
+    switch (f->type) {
+        case JSON_FIELD_INT64:
+        case JSON_FIELD_INT32:
+        case JSON_FIELD_DOUBLE: {
+            double number;
+            int64_t integer;
+            int is_integer;
+            if (*p->cur != '-' && !isdigit((unsigned char)*p->cur))
+                goto type;
+            if (!json__parse_number(p, &number, &integer, &is_integer))
+                goto fail;
+            if (f->type == JSON_FIELD_DOUBLE) {
+                memcpy(at, &number, sizeof number);
+            } else if (!is_integer) {
+                goto type;
+            } else if (f->type == JSON_FIELD_INT64) {
+                memcpy(at, &integer, sizeof integer);
+            } else {
+                if (integer < INT32_MIN || integer > INT32_MAX)
+                    goto type;
+                int32_t x = (int32_t)integer;
+                memcpy(at, &x, sizeof x);
+            }
+            return 1;
+        }
+        case JSON_FIELD_BOOL: {
+            int b;
+            if (json__match_literal(p, "true", 4))
+                b = 1;
+            else if (json__match_literal(p, "false", 5))
+                b = 0;
+            else
+                goto type;
+            memcpy(at, &b, sizeof b);
+            return 1;
+        }
+        case JSON_FIELD_STRING:
+        case JSON_FIELD_CHARS: {
+            if (*p->cur != '"')
+                goto type;
+            const char *k = ++p->cur;
+            int escaped;
+            if (!json__skip_string(p, &escaped))
+                goto fail;
+            const char *close = p->cur;
+            size_t l = close - k;
+            if (f->type == JSON_FIELD_CHARS) {
+                char small[256];
+                const char *x = json__string_view(p, k, &l, escaped, small, sizeof small);
+                if (!x)
+                    return 0;
+                if (l < f->size) {
+                    memcpy(at, x, l);
+                    at[l] = '\0';
+                }
+                json__string_view_free(x, k, small);
+                if (l >= f->size) {
+                    p->error = JSON_ERROR_TOO_LARGE;
+                    return 0;
+                }
+            } else {
+                if (!json__string_check(p, k, l))
+                    return 0;
+                char *x = json__heap_alloc(l + 1);
+                if (!x) {
+                    p->error = JSON_ERROR_MEMORY;
+                    return 0;
+                }
+                if (!escaped) {
+                    memcpy(x, k, l);
+                } else if ((l = json__unescape(p, x, k, l)) == SIZE_MAX) {
+                    json__heap_free(x);
+                    return 0;
+                }
+                x[l] = '\0';
+                memcpy(at, &x, sizeof x);
+            }
+            p->cur = close + 1;
+            return 1;
+        }
+        case JSON_FIELD_OBJECT:
+            return json__schema_object(p, s->entries[i].nested, at);
+        case JSON_FIELD_VALUE: {
+            json_arena *arena = p->arena;
+            p->arena = NULL;
+            json_value *v = json__parse_value(p);
+            p->arena = arena;
+            if (!v)
+                return 0;
+            memcpy(at, &v, sizeof v);
+            return 1;
+        }
+    }
+
+type:
+    p->error = JSON_ERROR_TYPE;
+    return 0;
+
+fail:
+    if (p->error == JSON_ERROR_NONE)
+        p->error = JSON_ERROR_SYNTAX;
+    return 0;
+}
+
+int json_schema_parse_ex(json_parser *p, const json_schema *s, void *out, const char *data, size_t len) {
+    p->cur = data;
+    p->end = data + len;
+    p->error = JSON_ERROR_NONE;
+    JSON__STATS_CLOCK(t);
+    int ok = json__schema_object(p, s, out);
+    if (ok) {
+        json__skip_whitespace(p);
+        if (p->cur < p->end) {
+            p->error = JSON_ERROR_SYNTAX;
+            ok = 0;
+        }
+    }
+    json__parse_position(p, data);
+    JSON__STATS_ADD(parses, 1);
+    JSON__STATS_ADD(bytes_parsed, len);
+    JSON__STATS_ELAPSED(parse_ns, t);
+    return ok;
+}
+
+int json_schema_parse(const json_schema *s, void *out, const char *data, size_t len) {
+    json_parser p = {0};
+    return json_schema_parse_ex(&p, s, out, data, len);
 }
 
 json_value *json_new_string(const char *s) {
-    json_value *v = json__new_value(JSON_STRING);
-    v->string = strdup(s);
-    return v;
+    return json__new_string_n(s, strlen(s));
 }
 
 json_value *json_new_number(double n) {
-    json_value *v = json__new_value(JSON_NUMBER);
+    json_value *v = json__new_value(NULL, JSON_NUMBER);
+    if (!v)
+        return NULL;
     v->number = n;
     return v;
 }
 
+json_value *json_new_integer(int64_t i) {
+    json_value *v = json__new_value(NULL, JSON_NUMBER);
+    if (!v)
+        return NULL;
+    v->flags |= JSON__FLAG_INTEGER;
+    v->integer = i;
+    return v;
+}
+
 json_value *json_new_boolean(int b) {
-    json_value *v = json__new_value(JSON_BOOL);
+    json_value *v = json__new_value(NULL, JSON_BOOL);
+    if (!v)
+        return NULL;
     v->boolean = b ? 1 : 0;
     return v;
 }
 
 json_value *json_new_null(void) {
-    return json__new_value(JSON_NULL);
+    return json__new_value(NULL, JSON_NULL);
 }
 
 json_value *json_new_object(void) {
-    return json__new_value(JSON_OBJECT);
+    return json__new_value(NULL, JSON_OBJECT);
 }
 
 json_value *json_new_array(void) {
-    return json__new_value(JSON_ARRAY);
+    return json__new_value(NULL, JSON_ARRAY);
 }
 
 json_type json_query_type(json_value *v) {
@@ -604,13 +6992,29 @@ json_type json_query_type(json_value *v) {
 }
 
 char *json_query_string(json_value *v) {
-    return v->string;
+    return v->string.data;
+}
+
+size_t json_query_string_len(json_value *v) {
+    return v->string.len;
 }
 
 double json_query_number(json_value *v) {
+    if (v->flags & JSON__FLAG_INTEGER)
+        return (double)v->integer;
     return v->number;
 }
 
+int64_t json_query_integer(json_value *v) {
+    if (v->flags & JSON__FLAG_INTEGER)
+        return v->integer;
+    return json__double_to_integer(v->number);
+}
+
+int json_query_is_integer(json_value *v) {
+    return (v->flags & JSON__FLAG_INTEGER) != 0;
+}
+
 int json_query_boolean(json_value *v) {
     return v->boolean;
 }